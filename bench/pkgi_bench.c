@@ -0,0 +1,1086 @@
+// known-answer tests and throughput benchmark for crypto and zRIF code, runs on host without Vita SDK
+//   pkgi_bench kat          - runs only known-answer tests, exit code is 0 when all of them pass
+//   pkgi_bench download     - downloads synthetic pkg from local HTTP server with real download code,
+//                             also kills download after its first checkpoint and checks that it resumes
+//   pkgi_bench [file.json]  - runs tests, prints MB/s for every backend and buffer size and saves
+//                             same results as json (pkgi_bench.json by default) for comparing builds
+
+#include "pkgi.h"
+#include "pkgi_aes128.h"
+#include "pkgi_bench_http.h"
+#include "pkgi_bench_pkg.h"
+#include "pkgi_config.h"
+#include "pkgi_download.h"
+#include "pkgi_posix.h"
+#include "pkgi_range.h"
+#include "pkgi_reader.h"
+#include "pkgi_keystream.h"
+#include "pkgi_sha256.h"
+#include "pkgi_zrif.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BENCH_ARCH "x86_64"
+#elif defined(__i386__) || defined(_M_IX86)
+#define BENCH_ARCH "x86"
+#elif defined(__aarch64__)
+#define BENCH_ARCH "arm64"
+#elif defined(__arm__)
+#define BENCH_ARCH "arm"
+#else
+#define BENCH_ARCH "unknown"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+// TSC ticks at nominal frequency, with turbo boost cycles/byte is only approximate
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0
+#endif
+
+#define BENCH_SECONDS 0.2
+#define BENCH_MAX_RESULTS 256
+// every timed step processes at least this many bytes, so small sizes do not measure the clock
+#define BENCH_STEP_SIZE (1024 * 1024)
+
+// hashes are measured on data larger than cache, in blocks of download size
+#define BENCH_STREAM_SIZE (32 * 1024 * 1024)
+#define BENCH_BLOCK_SIZE (64 * 1024)
+
+#define RIF_SIZE 512
+
+// local pkg is read from file larger than cache, in blocks of download size
+#define BENCH_READER_FILE "pkgi_bench_reader.bin"
+#define BENCH_READER_SIZE (2048ULL * 1024 * 1024)
+
+// download tests use temp folder in current folder, it is removed before and after every download
+#define BENCH_DOWNLOAD_FOLDER "pkgi_bench_temp"
+// same as RESUME_CHECKPOINT_SIZE in pkgi_download.c
+#define BENCH_CHECKPOINT_SIZE (32 * 1024 * 1024)
+// download benchmark, limited speed is per connection like on servers that throttle every request
+#define BENCH_DOWNLOAD_BIG_SIZE (32 * 1024 * 1024)
+#define BENCH_DOWNLOAD_SPEED (8 * 1024 * 1024)
+
+// resume test needs time to kill download between its first checkpoint and the end
+#define BENCH_RESUME_BIG_SIZE (96 * 1024 * 1024)
+#define BENCH_RESUME_SPEED (16 * 1024 * 1024)
+
+static const uint32_t bench_sizes[] = { 64, 1024, 16 * 1024, 64 * 1024, 1024 * 1024 };
+
+#if __ARM_NEON__
+static const char* const aes_backends[] = { "neon" };
+#else
+static const char* const aes_backends[] = { "c", "bitslice", "aesni", "vaes" };
+#endif
+
+static const char* const sha256_backends[] = { "c", "shani", "armv8" };
+
+typedef struct {
+    const char* name;
+    const char* backend;
+    uint32_t threads;
+    uint32_t size;
+    double mbps;
+    double cpb; // cycles/byte, 0 if cpu cycle counter is not available
+} BenchResult;
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static uint32_t result_count;
+static int failed;
+
+// synthetic rif compressed with zRIF dictionary, digest is SHA-256 of 512 byte rif
+static const char zrif_test[] =
+    "ePlifR1dQ+eHBhhAVbuCLQDZb4AKDPH5j9sgtGr+kZd8xhG1i46/ETQb7PHBLmJdc93ndou7irRO+JzfJexbqmPCc2Y/cT8SzXN9z+4r7CG7ba73RLu4p8x+E36n2oT9y2+Z8DXS"
+    "S9xZbp+5/sd6CvsU6z/Xz9xmcV8ivSZc5vcXdpPqO+FvZqe4u0T3XLfZHcJ+Zfee6zzRR9yfzM4Jj6newl7ye064jrSKe8ttn+s11iIDbT8AklKM6A==";
+static const char zrif_test_digest[] = "114ca3ee5fc5fa7079673c929b077d3ff7d204ace96023a63a4dee2f32870a1d";
+
+static double bench_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void hex_decode(const char* hex, uint8_t* out)
+{
+    for (size_t i = 0; hex[2 * i]; i++)
+    {
+        unsigned value;
+        sscanf(hex + 2 * i, "%2x", &value);
+        out[i] = (uint8_t)value;
+    }
+}
+
+static void check(int ok, const char* msg, ...)
+{
+    if (!ok)
+    {
+        va_list args;
+        va_start(args, msg);
+        printf("FAIL: ");
+        vprintf(msg, args);
+        printf("\n");
+        va_end(args);
+        failed = 1;
+    }
+}
+
+// returns 0 if cpu does not support backend
+static int aes_select(aes128_ctx* ctx, int backend)
+{
+#if __ARM_NEON__
+    PKGI_UNUSED(ctx);
+    return backend == 0;
+#else
+    return aes128_ctr_set_backend(ctx, backend);
+#endif
+}
+
+static void kat_aes(void)
+{
+    // FIPS-197, appendix C.1
+    {
+        uint8_t key[16], input[16], expected[16], output[16];
+        hex_decode("000102030405060708090a0b0c0d0e0f", key);
+        hex_decode("00112233445566778899aabbccddeeff", input);
+        hex_decode("69c4e0d86a7b0430d8cdb78070b4c55a", expected);
+
+        aes128_ctx ctx;
+        aes128_init(&ctx, key);
+        aes128_encrypt(&ctx, input, output);
+        check(memcmp(output, expected, sizeof(output)) == 0, "AES-128 FIPS-197 C.1");
+    }
+
+    uint8_t key[16], iv[16], plain[64], cipher[64];
+    // NIST SP 800-38A, F.5.1 CTR-AES128.Encrypt
+    hex_decode("2b7e151628aed2a6abf7158809cf4f3c", key);
+    hex_decode("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", iv);
+    hex_decode("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+               "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710", plain);
+    hex_decode("874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+               "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee", cipher);
+
+    // larger buffer goes through multi block loops, counter low 64 bits overflow after 16 blocks
+    const uint32_t size = 64 * 1024;
+    uint8_t iv_carry[16];
+    hex_decode("000102030405060708fffffffffffff0", iv_carry);
+
+    uint8_t* source = malloc(size);
+    uint8_t* reference = malloc(size);
+    uint8_t* buffer = malloc(size);
+    srand(1);
+    for (uint32_t i = 0; i < size; i++)
+    {
+        source[i] = (uint8_t)rand();
+    }
+
+    aes128_ctx ctx;
+    aes128_ctr_init(&ctx, key);
+    aes_select(&ctx, 0);
+    memcpy(reference, source, size);
+    aes128_ctr(&ctx, iv_carry, 0, reference, size);
+
+    for (int backend = 0; backend < (int)PKGI_COUNTOF(aes_backends); backend++)
+    {
+        aes128_ctr_init(&ctx, key);
+        if (!aes_select(&ctx, backend))
+        {
+            continue;
+        }
+        const char* name = aes_backends[backend];
+
+        // whole vector and every split in three parts at any offset, not only block aligned ones
+        int ok = 1;
+        for (uint32_t a = 0; a <= sizeof(plain) && ok; a++)
+        {
+            for (uint32_t b = a; b <= sizeof(plain) && ok; b++)
+            {
+                uint8_t output[64];
+                memcpy(output, plain, sizeof(plain));
+                aes128_ctr(&ctx, iv, 0, output, a);
+                aes128_ctr(&ctx, iv, a, output + a, b - a);
+                aes128_ctr(&ctx, iv, b, output + b, sizeof(output) - b);
+                ok = memcmp(output, cipher, sizeof(cipher)) == 0;
+                check(ok, "AES-128-CTR SP 800-38A F.5.1 %s, split at %u and %u", name, a, b);
+            }
+        }
+
+        // every start within first 4 blocks and every size up to 10 blocks, so partial blocks before
+        // and after 4 and 8 block batches are tested
+        for (uint32_t offset = 0; offset < 4 * AES_BLOCK_SIZE && ok; offset++)
+        {
+            for (uint32_t length = 0; length <= 10 * AES_BLOCK_SIZE && ok; length++)
+            {
+                memcpy(buffer, source + offset, length);
+                aes128_ctr(&ctx, iv_carry, offset, buffer, length);
+                ok = memcmp(buffer, reference + offset, length) == 0;
+                check(ok, "AES-128-CTR %s differs from C at offset %u, size %u", name, offset, length);
+            }
+        }
+
+        // random unaligned offsets and sizes compared with C backend over same stream
+        for (int i = 0; i < 500; i++)
+        {
+            uint32_t offset = rand() % size;
+            uint32_t length = rand() % (size - offset + 1);
+            if (i < 200)
+            {
+                length = min32(length, 300);
+            }
+            memcpy(buffer, source + offset, length);
+            aes128_ctr(&ctx, iv_carry, offset, buffer, length);
+            if (memcmp(buffer, reference + offset, length) != 0)
+            {
+                check(0, "AES-128-CTR %s differs from C at offset %u, size %u", name, offset, length);
+                break;
+            }
+        }
+    }
+
+    free(buffer);
+    free(reference);
+    free(source);
+}
+
+static void kat_sha256(void)
+{
+    // FIPS 180-2, appendix B and NIST example values
+    static const struct {
+        const char* input;
+        uint32_t repeat;
+        const char* digest;
+    } vectors[] = {
+        { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+        { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+        { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1, "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+        { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+    };
+    static const uint32_t steps[] = { 1, 63, 64, 65, 1000 };
+
+    uint8_t* input = malloc(1000000);
+
+    for (int backend = 0; backend < (int)PKGI_COUNTOF(sha256_backends); backend++)
+    {
+        if (!sha256_set_backend(backend))
+        {
+            continue;
+        }
+
+        for (uint32_t v = 0; v < PKGI_COUNTOF(vectors); v++)
+        {
+            uint32_t len = (uint32_t)strlen(vectors[v].input);
+            uint32_t size = len * vectors[v].repeat;
+            for (uint32_t i = 0; i < vectors[v].repeat; i++)
+            {
+                memcpy(input + i * len, vectors[v].input, len);
+            }
+
+            uint8_t expected[SHA256_DIGEST_SIZE];
+            hex_decode(vectors[v].digest, expected);
+
+            // same message in different update sizes, so buffered partial blocks are tested too
+            for (uint32_t s = 0; s < PKGI_COUNTOF(steps); s++)
+            {
+                sha256_ctx ctx;
+                sha256_init(&ctx);
+                for (uint32_t pos = 0; pos < size; pos += steps[s])
+                {
+                    sha256_update(&ctx, input + pos, min32(steps[s], size - pos));
+                }
+
+                uint8_t digest[SHA256_DIGEST_SIZE];
+                sha256_finish(&ctx, digest);
+                check(memcmp(digest, expected, sizeof(digest)) == 0, "SHA-256 %s vector %u, update size %u", sha256_backends[backend], v, steps[s]);
+            }
+
+            // whole message at once, so sha256_update2 goes through more than one step
+            sha256_ctx first, second;
+            sha256_init(&first);
+            sha256_init(&second);
+            sha256_update2(&first, &second, input, size);
+
+            uint8_t digest[SHA256_DIGEST_SIZE];
+            sha256_finish(&first, digest);
+            check(memcmp(digest, expected, sizeof(digest)) == 0, "SHA-256 %s vector %u, first hash of sha256_update2", sha256_backends[backend], v);
+            sha256_finish(&second, digest);
+            check(memcmp(digest, expected, sizeof(digest)) == 0, "SHA-256 %s vector %u, second hash of sha256_update2", sha256_backends[backend], v);
+        }
+    }
+    sha256_setup();
+
+    free(input);
+}
+
+static void kat_zrif(void)
+{
+    uint8_t rif[RIF_SIZE];
+    char error[256];
+    int ok = pkgi_zrif_decode(zrif_test, rif, error, sizeof(error));
+    check(ok, "zRIF decode failed: %s", ok ? "" : error);
+
+    uint8_t expected[SHA256_DIGEST_SIZE];
+    hex_decode(zrif_test_digest, expected);
+
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, rif, sizeof(rif));
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_finish(&ctx, digest);
+    check(ok && memcmp(digest, expected, sizeof(digest)) == 0, "zRIF decoded to wrong rif");
+
+    // any change of compressed data must be rejected, at latest by adler32 check
+    char corrupted[sizeof(zrif_test)];
+    memcpy(corrupted, zrif_test, sizeof(zrif_test));
+    corrupted[100] = corrupted[100] == 'A' ? 'B' : 'A';
+    check(!pkgi_zrif_decode(corrupted, rif, error, sizeof(error)), "corrupted zRIF was decoded");
+}
+
+static void kat_parallel(void)
+{
+    static const uint32_t sizes[] = { 0, 1, 15, 16 * 1024 - 1, 16 * 1024 + 5, 100 * 1024 + 3, 1024 * 1024 + 7 };
+    static const uint32_t offsets[] = { 0, 1, 15, 17, 123457 };
+    const uint32_t max_size = 1024 * 1024 + 7;
+
+    uint8_t key[16], iv[16];
+    hex_decode("000102030405060708090a0b0c0d0e0f", key);
+    hex_decode("000102030405060708fffffffffffff0", iv);
+
+    uint8_t* source = malloc(max_size);
+    uint8_t* reference = malloc(max_size);
+    uint8_t* buffer = malloc(max_size);
+    for (uint32_t i = 0; i < max_size; i++)
+    {
+        source[i] = (uint8_t)rand();
+    }
+
+    aes128_ctx ctx;
+    aes128_ctr_init(&ctx, key);
+
+    // parts are split at block boundaries, result must not depend on worker count or offset alignment
+    for (uint32_t threads = 0; threads <= 3; threads++)
+    {
+        uint32_t started = aes128_ctr_parallel_start(threads);
+        check(started == threads, "started %u aes threads instead of %u", started, threads);
+
+        for (uint32_t s = 0; s < PKGI_COUNTOF(sizes); s++)
+        {
+            for (uint32_t o = 0; o < PKGI_COUNTOF(offsets); o++)
+            {
+                memcpy(reference, source, sizes[s]);
+                aes128_ctr(&ctx, iv, offsets[o], reference, sizes[s]);
+
+                memcpy(buffer, source, sizes[s]);
+                aes128_ctr_parallel(&ctx, iv, offsets[o], buffer, sizes[s]);
+                check(memcmp(buffer, reference, sizes[s]) == 0, "aes128_ctr_parallel with %u threads differs at offset %u, size %u", started, offsets[o], sizes[s]);
+            }
+        }
+
+        aes128_ctr_parallel_stop();
+    }
+
+    free(buffer);
+    free(reference);
+    free(source);
+}
+
+static void kat_keystream(void)
+{
+    const uint32_t size = 4 * PKGI_KEYSTREAM_SIZE;
+    const uint64_t base = 0x123456789; // not block aligned
+
+    uint8_t key[16], iv[16];
+    hex_decode("000102030405060708090a0b0c0d0e0f", key);
+    hex_decode("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", iv);
+
+    uint8_t* source = malloc(size);
+    uint8_t* reference = malloc(size);
+    uint8_t* buffer = malloc(size);
+    for (uint32_t i = 0; i < size; i++)
+    {
+        source[i] = (uint8_t)rand();
+    }
+
+    aes128_ctx ctx;
+    aes128_ctr_init(&ctx, key);
+    memcpy(reference, source, size);
+    aes128_ctr(&ctx, iv, base, reference, size);
+
+    static pkgi_keystream ks;
+    pkgi_keystream_init(&ks, &ctx, iv);
+
+    // stream is decrypted in chunks of any size while keystream is generated in between, like
+    // network reads of download thread, sometimes it jumps forward or back like next file does
+    uint64_t decrypted = 0;
+    uint32_t position = 0;
+    for (int i = 0; i < 3000; i++)
+    {
+        if (rand() % 50 == 0)
+        {
+            position = rand() % size;
+        }
+        uint32_t length = min32(size - position, rand() % 2 ? rand() % 64 : rand() % 40000);
+
+        uint32_t steps = rand() % 20;
+        for (uint32_t s = 0; s < steps && pkgi_keystream_generate(&ks); s++)
+        {
+        }
+
+        memcpy(buffer, source + position, length);
+        pkgi_keystream_decrypt(&ks, buffer, base + position, length);
+        if (memcmp(buffer, reference + position, length) != 0)
+        {
+            check(0, "keystream differs from aes128_ctr at offset %u, size %u", position, length);
+            break;
+        }
+
+        decrypted += length;
+        position += length;
+        if (position == size)
+        {
+            position = 0;
+        }
+    }
+
+    check(ks.prefetched != 0 && ks.computed != 0, "keystream was not prefetched or not computed");
+    check(ks.prefetched + ks.computed == decrypted, "keystream counted %llu bytes, decrypted %llu",
+        (unsigned long long)(ks.prefetched + ks.computed), (unsigned long long)decrypted);
+
+    free(buffer);
+    free(reference);
+    free(source);
+}
+
+static void kat_dispatch(void)
+{
+#if !__ARM_NEON__
+    static const uint8_t key[16];
+    aes128_ctx ctx;
+    aes128_ctr_init(&ctx, key);
+    int detected = ctx.backend;
+    check(detected != AES128_BACKEND_BITSLICE, "aes128_ctr_init selected bitslice, it must be only forced");
+
+    // every slower backend and bitslice can be forced, faster ones are rejected
+    int supported = max32(detected, AES128_BACKEND_BITSLICE);
+    for (int backend = 0; backend < (int)PKGI_COUNTOF(aes_backends); backend++)
+    {
+        check(aes128_ctr_set_backend(&ctx, backend) == (backend <= supported), "AES backend %s can%s be forced with %s detected",
+            aes_backends[backend], backend <= supported ? "not" : "", aes_backends[detected]);
+    }
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    // cpuid checks in aes128_ctr_init and sha256_setup must agree with compiler's own cpu detection
+    __builtin_cpu_init();
+
+    int aes = AES128_BACKEND_C;
+    if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3"))
+    {
+        aes = __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2") ? AES128_BACKEND_VAES : AES128_BACKEND_AESNI;
+    }
+    check(detected == aes, "aes128_ctr_init selected %s, cpu supports %s", aes_backends[detected], aes_backends[aes]);
+
+    int sha = SHA256_BACKEND_C;
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3"))
+    {
+        sha = SHA256_BACKEND_SHANI;
+    }
+    int selected = sha256_setup();
+    check(selected == sha, "sha256_setup selected %s, cpu supports %s", sha256_backends[selected], sha256_backends[sha]);
+#elif defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+    int selected = sha256_setup();
+    check(selected == SHA256_BACKEND_ARMV8, "sha256_setup selected %s in build with ARMv8 crypto extension", sha256_backends[selected]);
+#endif
+}
+
+// saves result for json and prints it
+static void bench_save(const char* name, const char* backend, uint32_t threads, uint32_t size, double mbps, double cpb)
+{
+    if (result_count < BENCH_MAX_RESULTS)
+    {
+        BenchResult* result = results + result_count++;
+        result->name = name;
+        result->backend = backend;
+        result->threads = threads;
+        result->size = size;
+        result->mbps = mbps;
+        result->cpb = cpb;
+    }
+
+    if (cpb != 0)
+    {
+        printf("%-20s %-10s %7u %8u %10.1f MB/s %8.2f\n", name, backend, threads, size, mbps, cpb);
+    }
+    else
+    {
+        printf("%-20s %-10s %7u %8u %10.1f MB/s %8s\n", name, backend, threads, size, mbps, "-");
+    }
+}
+
+typedef void BenchFunc(uint8_t* buffer, uint32_t size, uint64_t offset);
+
+// calls func repeatedly with size bytes and saves its MB/s and cycles/byte
+static void bench_measure(const char* name, const char* backend, uint32_t threads, BenchFunc* func, uint8_t* buffer, uint32_t size)
+{
+    uint32_t repeat = max32(1, BENCH_STEP_SIZE / size);
+    uint64_t total = 0;
+
+    double start = bench_time();
+    uint64_t start_cycles = BENCH_CYCLES();
+    double elapsed;
+    do
+    {
+        for (uint32_t i = 0; i < repeat; i++)
+        {
+            func(buffer, size, total);
+            total += size;
+        }
+        elapsed = bench_time() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    double mbps = total / elapsed / 1e6;
+    double cpb = (double)(BENCH_CYCLES() - start_cycles) / total;
+
+    bench_save(name, backend, threads, size, mbps, cpb);
+}
+
+static aes128_ctx bench_aes_ctx;
+static const uint8_t bench_iv[16];
+
+static void bench_aes_func(uint8_t* buffer, uint32_t size, uint64_t offset)
+{
+    aes128_ctr(&bench_aes_ctx, bench_iv, offset, buffer, size);
+}
+
+static void bench_parallel_func(uint8_t* buffer, uint32_t size, uint64_t offset)
+{
+    aes128_ctr_parallel(&bench_aes_ctx, bench_iv, offset, buffer, size);
+}
+
+static sha256_ctx bench_sha256_ctx;
+
+static void bench_sha256_func(uint8_t* buffer, uint32_t size, uint64_t offset)
+{
+    PKGI_UNUSED(offset);
+    sha256_update(&bench_sha256_ctx, buffer, size);
+}
+
+static sha256_ctx bench_chunk_sha256_ctx;
+
+// pkg and chunk hash of hash thread, each reads whole block
+static void bench_two_hash_func(uint8_t* buffer, uint32_t size, uint64_t offset)
+{
+    PKGI_UNUSED(offset);
+    for (uint32_t position = 0; position < size; position += BENCH_BLOCK_SIZE)
+    {
+        sha256_update(&bench_sha256_ctx, buffer + position, BENCH_BLOCK_SIZE);
+        sha256_update(&bench_chunk_sha256_ctx, buffer + position, BENCH_BLOCK_SIZE);
+    }
+}
+
+// same work with sha256_update2, like hash_block in pkgi_download.c
+static void bench_update2_func(uint8_t* buffer, uint32_t size, uint64_t offset)
+{
+    PKGI_UNUSED(offset);
+    for (uint32_t position = 0; position < size; position += BENCH_BLOCK_SIZE)
+    {
+        sha256_update2(&bench_sha256_ctx, &bench_chunk_sha256_ctx, buffer + position, BENCH_BLOCK_SIZE);
+    }
+}
+
+static void bench_zrif_func(uint8_t* buffer, uint32_t size, uint64_t offset)
+{
+    PKGI_UNUSED(size);
+    PKGI_UNUSED(offset);
+    char error[256];
+    pkgi_zrif_decode(zrif_test, buffer, error, sizeof(error));
+}
+
+static void bench_aes(uint8_t* buffer)
+{
+    static const uint8_t key[16];
+
+    for (int backend = 0; backend < (int)PKGI_COUNTOF(aes_backends); backend++)
+    {
+        aes128_ctr_init(&bench_aes_ctx, key);
+        if (!aes_select(&bench_aes_ctx, backend))
+        {
+            continue;
+        }
+
+        for (uint32_t s = 0; s < PKGI_COUNTOF(bench_sizes); s++)
+        {
+            bench_measure("aes128_ctr", aes_backends[backend], 1, &bench_aes_func, buffer, bench_sizes[s]);
+        }
+    }
+}
+
+static void bench_parallel(uint8_t* buffer)
+{
+    static const uint8_t key[16];
+    static const uint32_t sizes[] = { 64 * 1024, 1024 * 1024 };
+
+    aes128_ctr_init(&bench_aes_ctx, key);
+#if __ARM_NEON__
+    int fastest = 0;
+#else
+    int fastest = bench_aes_ctx.backend;
+#endif
+
+    // scaling of C backend and of fastest one, threads include calling thread
+    int backends[] = { 0, fastest };
+    for (uint32_t b = 0; b < (fastest ? 2u : 1u); b++)
+    {
+        aes128_ctr_init(&bench_aes_ctx, key);
+        aes_select(&bench_aes_ctx, backends[b]);
+
+        for (uint32_t threads = 0; threads <= 3; threads++)
+        {
+            if (aes128_ctr_parallel_start(threads) == threads)
+            {
+                for (uint32_t s = 0; s < PKGI_COUNTOF(sizes); s++)
+                {
+                    bench_measure("aes128_ctr_parallel", aes_backends[backends[b]], threads + 1, &bench_parallel_func, buffer, sizes[s]);
+                }
+            }
+            aes128_ctr_parallel_stop();
+        }
+    }
+}
+
+static void bench_sha256(uint8_t* buffer)
+{
+    for (int backend = 0; backend < (int)PKGI_COUNTOF(sha256_backends); backend++)
+    {
+        if (!sha256_set_backend(backend))
+        {
+            continue;
+        }
+
+        sha256_init(&bench_sha256_ctx);
+        for (uint32_t s = 0; s < PKGI_COUNTOF(bench_sizes); s++)
+        {
+            bench_measure("sha256", sha256_backends[backend], 1, &bench_sha256_func, buffer, bench_sizes[s]);
+        }
+    }
+    sha256_setup();
+}
+
+// pkg and chunk hash of hash thread, sha256 is not fused with decryption, because it runs in another thread
+static void bench_hash2(void)
+{
+    uint8_t* stream = malloc(BENCH_STREAM_SIZE);
+    memset(stream, 0x5a, BENCH_STREAM_SIZE);
+
+    // C backend is closest to Vita, where sha256 takes most of cpu time of hash thread
+    const char* const names[] = { "c", "fastest" };
+    for (int b = 0; b < 2; b++)
+    {
+        if (b == 0)
+        {
+            sha256_set_backend(SHA256_BACKEND_C);
+        }
+        else
+        {
+            sha256_setup();
+        }
+
+        sha256_init(&bench_sha256_ctx);
+        sha256_init(&bench_chunk_sha256_ctx);
+        bench_measure("hash x2 2-pass", names[b], 1, &bench_two_hash_func, stream, BENCH_STREAM_SIZE);
+        bench_measure("hash x2 update2", names[b], 1, &bench_update2_func, stream, BENCH_STREAM_SIZE);
+    }
+
+    free(stream);
+}
+
+static volatile uint64_t bench_reader_sum;
+
+// touches every word like hash would, so mapped pages are faulted in and measured
+static void bench_reader_use(const uint8_t* data, uint32_t size)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i + 8 <= size; i += 8)
+    {
+        uint64_t value;
+        memcpy(&value, data + i, sizeof(value));
+        sum ^= value;
+    }
+    bench_reader_sum ^= sum;
+}
+
+// pkgi_reader with mapped file and with read ahead thread (Vita path), compared to plain pread loop,
+// file was just written, so mostly it is read from page cache and not from disk
+static void bench_reader(uint8_t* buffer)
+{
+    FILE* f = fopen(BENCH_READER_FILE, "wb");
+    int created = f != NULL;
+    for (uint64_t offset = 0; created && offset < BENCH_READER_SIZE; offset += BENCH_STEP_SIZE)
+    {
+        created = fwrite(buffer, BENCH_STEP_SIZE, 1, f) == 1;
+    }
+    if (f)
+    {
+        created = fclose(f) == 0 && created;
+    }
+    if (!created)
+    {
+        printf("cannot create %s for reader benchmark\n", BENCH_READER_FILE);
+        remove(BENCH_READER_FILE);
+        return;
+    }
+
+    const char* const names[] = { "mmap", "thread", "pread" };
+    for (int mode = 0; mode < 3; mode++)
+    {
+        uint64_t total = 0;
+        double start = bench_time();
+        uint64_t start_cycles = BENCH_CYCLES();
+
+        if (mode < 2)
+        {
+            pkgi_posix_set_map(mode == 0);
+            if (pkgi_reader_start(BENCH_READER_FILE, 0) < 0)
+            {
+                printf("cannot start reader for %s\n", BENCH_READER_FILE);
+                continue;
+            }
+
+            const uint8_t* data;
+            int read;
+            while ((read = pkgi_reader_next(&data, BENCH_BLOCK_SIZE)) > 0)
+            {
+                bench_reader_use(data, read);
+                total += read;
+            }
+            pkgi_reader_stop();
+            pkgi_posix_set_map(1);
+        }
+        else
+        {
+            int fd = open(BENCH_READER_FILE, O_RDONLY);
+            ssize_t read;
+            while (fd >= 0 && (read = pread(fd, buffer, BENCH_BLOCK_SIZE, total)) > 0)
+            {
+                bench_reader_use(buffer, (uint32_t)read);
+                total += read;
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        double elapsed = bench_time() - start;
+        double cpb = total ? (double)(BENCH_CYCLES() - start_cycles) / total : 0;
+        check(total == BENCH_READER_SIZE, "reader %s read %llu bytes", names[mode], (unsigned long long)total);
+        bench_save("reader", names[mode], 1, BENCH_BLOCK_SIZE, total / elapsed / 1e6, cpb);
+    }
+
+    remove(BENCH_READER_FILE);
+}
+
+static void bench_zrif(uint8_t* buffer)
+{
+    // inflate speed of puff is measured in decoded rif bytes
+    bench_measure("zrif_decode", "puff", 1, &bench_zrif_func, buffer, RIF_SIZE);
+}
+
+static int download_remove(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    PKGI_UNUSED(st);
+    PKGI_UNUSED(flag);
+    PKGI_UNUSED(ftw);
+    return remove(path);
+}
+
+static void download_clean(void)
+{
+    nftw(BENCH_DOWNLOAD_FOLDER, &download_remove, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int download_run(const BenchPkg* pkg, const char* url, uint32_t connections, int spool, int preallocate)
+{
+    Config config;
+    memset(&config, 0, sizeof(config));
+    config.connections = connections;
+    config.write_buffer = PKGI_WRITE_BUFFER_SIZE;
+    config.spool = spool;
+    config.preallocate = preallocate;
+    return pkgi_download(BENCH_PKG_CONTENT, url, NULL, pkg->digest, &config);
+}
+
+// download is killed in child process after it saves first checkpoint, then it must continue from that
+// checkpoint and not from start, files closed before checkpoint must survive kill too
+static void test_resume(const char* url)
+{
+    BenchPkg pkg;
+    if (!bench_pkg_create(&pkg, 200, BENCH_RESUME_BIG_SIZE, 2))
+    {
+        check(0, "cannot create pkg for resume test");
+        return;
+    }
+
+    uint16_t port = bench_http_start(pkg.data, pkg.size);
+    check(port != 0, "cannot start HTTP server");
+    if (port == 0)
+    {
+        bench_pkg_free(&pkg);
+        return;
+    }
+
+    char pkg_url[256];
+    snprintf(pkg_url, sizeof(pkg_url), url, port);
+
+    download_clean();
+    mkdir(BENCH_DOWNLOAD_FOLDER, 0755);
+    bench_http_set_speed(BENCH_RESUME_SPEED);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        _exit(download_run(&pkg, pkg_url, 1, 0, 0) ? 0 : 1);
+    }
+
+    int saved = 0;
+    if (pid > 0)
+    {
+        struct stat st;
+        double start = bench_time();
+        while (bench_time() - start < 60)
+        {
+            if (stat(BENCH_DOWNLOAD_FOLDER "/" BENCH_PKG_TITLE ".resume", &st) == 0)
+            {
+                saved = 1;
+                break;
+            }
+            if (waitpid(pid, NULL, WNOHANG) == pid)
+            {
+                pid = 0;
+                break;
+            }
+            usleep(10 * 1000);
+        }
+
+        // kill happens while next part of pkg is written, not right after checkpoint
+        usleep(300 * 1000);
+        if (pid > 0)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+    }
+    check(saved, "download finished or failed before its first checkpoint");
+
+    bench_http_set_speed(0);
+    bench_http_take_sent();
+
+    int downloaded = download_run(&pkg, pkg_url, 1, 0, 0);
+    uint64_t sent = bench_http_take_sent();
+    check(downloaded, "resumed download failed");
+    check(downloaded && bench_pkg_verify(&pkg, BENCH_DOWNLOAD_FOLDER "/" BENCH_PKG_TITLE), "resumed download has wrong files");
+    check(sent != 0 && sent <= pkg.size - BENCH_CHECKPOINT_SIZE, "resumed download got %llu of %llu bytes",
+        (unsigned long long)sent, (unsigned long long)pkg.size);
+    printf("resumed download got %llu of %llu bytes\n", (unsigned long long)sent, (unsigned long long)pkg.size);
+
+    bench_http_stop();
+    download_clean();
+    bench_pkg_free(&pkg);
+}
+
+static void test_download(void)
+{
+    static const char url[] = "http://127.0.0.1:%u/test.pkg";
+
+    pkgi_posix_set_folder(BENCH_DOWNLOAD_FOLDER);
+
+    BenchPkg pkg;
+    if (!bench_pkg_create(&pkg, 500, 0, 1))
+    {
+        check(0, "cannot create pkg for download test");
+        return;
+    }
+
+    uint16_t port = bench_http_start(pkg.data, pkg.size);
+    check(port != 0, "cannot start HTTP server");
+    if (port != 0)
+    {
+        char pkg_url[256];
+        snprintf(pkg_url, sizeof(pkg_url), url, port);
+
+        const uint32_t connections[] = { 1, PKGI_RANGE_MAX_CONNECTIONS };
+        for (uint32_t c = 0; c < PKGI_COUNTOF(connections); c++)
+        {
+            for (int mode = 0; mode < 4; mode++)
+            {
+                int spool = mode & 1;
+                int preallocate = mode >> 1;
+
+                download_clean();
+                mkdir(BENCH_DOWNLOAD_FOLDER, 0755);
+
+                int downloaded = download_run(&pkg, pkg_url, connections[c], spool, preallocate);
+                check(downloaded, "download with %u connections (spool %d, preallocate %d) failed", connections[c], spool, preallocate);
+                check(downloaded && bench_pkg_verify(&pkg, BENCH_DOWNLOAD_FOLDER "/" BENCH_PKG_TITLE),
+                    "download with %u connections (spool %d, preallocate %d) has wrong files", connections[c], spool, preallocate);
+            }
+        }
+        bench_http_stop();
+    }
+    download_clean();
+    bench_pkg_free(&pkg);
+
+    test_resume(url);
+}
+
+// MB/s of whole download with 1..PKGI_RANGE_MAX_CONNECTIONS connections, without and with speed limit
+static void bench_download(void)
+{
+    pkgi_posix_set_folder(BENCH_DOWNLOAD_FOLDER);
+
+    BenchPkg pkg;
+    if (!bench_pkg_create(&pkg, 100, BENCH_DOWNLOAD_BIG_SIZE, 3))
+    {
+        printf("cannot create pkg for download benchmark\n");
+        return;
+    }
+
+    uint16_t port = bench_http_start(pkg.data, pkg.size);
+    if (port == 0)
+    {
+        printf("cannot start HTTP server for download benchmark\n");
+        bench_pkg_free(&pkg);
+        return;
+    }
+
+    char url[256];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/test.pkg", port);
+
+    const char* const names[] = { "unlimited", "limited" };
+    for (int limited = 0; limited < 2; limited++)
+    {
+        bench_http_set_speed(limited ? BENCH_DOWNLOAD_SPEED : 0);
+        for (uint32_t connections = 1; connections <= PKGI_RANGE_MAX_CONNECTIONS; connections++)
+        {
+            download_clean();
+            mkdir(BENCH_DOWNLOAD_FOLDER, 0755);
+
+            double start = bench_time();
+            int downloaded = download_run(&pkg, url, connections, 0, 0);
+            double elapsed = bench_time() - start;
+
+            check(downloaded, "download with %u connections failed", connections);
+            if (downloaded)
+            {
+                bench_save("download", names[limited], connections, (uint32_t)pkg.size, pkg.size / elapsed / 1e6, 0);
+            }
+        }
+    }
+
+    bench_http_stop();
+    download_clean();
+    bench_pkg_free(&pkg);
+}
+
+static int save_json(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+    {
+        return 0;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"arch\": \"%s\",\n", BENCH_ARCH);
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(f, "  \"results\": [\n");
+    for (uint32_t i = 0; i < result_count; i++)
+    {
+        const BenchResult* r = results + i;
+        char cpb[32] = "null";
+        if (r->cpb != 0)
+        {
+            snprintf(cpb, sizeof(cpb), "%.2f", r->cpb);
+        }
+        fprintf(f, "    { \"name\": \"%s\", \"backend\": \"%s\", \"threads\": %u, \"size\": %u, \"mbps\": %.1f, \"cycles_per_byte\": %s }%s\n",
+            r->name, r->backend, r->threads, r->size, r->mbps, cpb, i + 1 < result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+
+    return fclose(f) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    sha256_setup();
+    pkgi_zrif_init();
+
+    int kat_only = argc > 1 && strcmp(argv[1], "kat") == 0;
+    int download_only = argc > 1 && strcmp(argv[1], "download") == 0;
+    const char* json = argc > 1 && !kat_only && !download_only ? argv[1] : "pkgi_bench.json";
+
+    kat_aes();
+    kat_sha256();
+    kat_parallel();
+    kat_keystream();
+    kat_zrif();
+    kat_dispatch();
+    if (failed)
+    {
+        printf("known-answer tests failed\n");
+        return 1;
+    }
+    printf("known-answer tests passed\n");
+
+    if (kat_only)
+    {
+        return 0;
+    }
+
+    test_download();
+    if (failed)
+    {
+        printf("download tests failed\n");
+        return 1;
+    }
+    printf("download tests passed\n");
+
+    if (download_only)
+    {
+        return 0;
+    }
+
+    uint8_t* buffer = malloc(BENCH_STEP_SIZE);
+    memset(buffer, 0x5a, BENCH_STEP_SIZE);
+
+    printf("\n%-20s %-10s %7s %8s %15s %8s\n", "name", "backend", "threads", "size", "speed", "cycles/B");
+    bench_aes(buffer);
+    bench_parallel(buffer);
+    bench_sha256(buffer);
+    bench_hash2();
+    bench_zrif(buffer);
+    bench_reader(buffer);
+    bench_download();
+
+    free(buffer);
+
+    if (!save_json(json))
+    {
+        printf("failed to save %s\n", json);
+        return 1;
+    }
+    printf("\nsaved %s\n", json);
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "pkgi_bench_http.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_HTTP_REQUEST_SIZE 4096
+#define BENCH_HTTP_SEND_SIZE (16 * 1024)
+
+static const uint8_t* http_data;
+static uint64_t http_size;
+static int http_socket = -1;
+static pthread_t http_thread;
+static volatile uint32_t http_speed;
+static uint64_t http_sent;
+
+static double http_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int http_send_all(int fd, const void* data, size_t size)
+{
+    const uint8_t* data8 = data;
+    while (size != 0)
+    {
+        ssize_t sent = send(fd, data8, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return 0;
+        }
+        data8 += sent;
+        size -= (size_t)sent;
+    }
+    return 1;
+}
+
+static void http_respond(int fd)
+{
+    char request[BENCH_HTTP_REQUEST_SIZE + 1];
+    size_t received = 0;
+    while (received < BENCH_HTTP_REQUEST_SIZE)
+    {
+        ssize_t read_size = recv(fd, request + received, BENCH_HTTP_REQUEST_SIZE - received, 0);
+        if (read_size <= 0)
+        {
+            return;
+        }
+        received += (size_t)read_size;
+        request[received] = 0;
+        if (strstr(request, "\r\n\r\n"))
+        {
+            break;
+        }
+    }
+
+    char path[256];
+    if (sscanf(request, "GET %255s ", path) != 1 || strlen(path) < 4 || strcmp(path + strlen(path) - 4, ".pkg") != 0)
+    {
+        static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        http_send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    uint64_t start = 0;
+    uint64_t end = http_size;
+    const char* range = strcasestr(request, "\r\nRange: bytes=");
+    if (range)
+    {
+        unsigned long long first, last;
+        int count = sscanf(range + 15, "%llu-%llu", &first, &last);
+        if (count >= 1)
+        {
+            start = first;
+        }
+        if (count == 2 && last + 1 < end)
+        {
+            end = last + 1;
+        }
+    }
+    if (start > end)
+    {
+        static const char bad_range[] = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        http_send_all(fd, bad_range, sizeof(bad_range) - 1);
+        return;
+    }
+
+    char headers[256];
+    int len = snprintf(headers, sizeof(headers), "HTTP/1.1 %s\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+        range ? "206 Partial Content" : "200 OK", (unsigned long long)(end - start));
+    if (!http_send_all(fd, headers, len))
+    {
+        return;
+    }
+
+    double begin = http_time();
+    for (uint64_t offset = start; offset != end; )
+    {
+        uint32_t size = end - offset < BENCH_HTTP_SEND_SIZE ? (uint32_t)(end - offset) : BENCH_HTTP_SEND_SIZE;
+
+        // every connection is limited separately, like servers that throttle each download
+        uint32_t speed = http_speed;
+        if (speed != 0)
+        {
+            double wait = begin + (double)(offset - start + size) / speed - http_time();
+            if (wait > 0)
+            {
+                usleep((useconds_t)(wait * 1e6));
+            }
+        }
+
+        if (!http_send_all(fd, http_data + offset, size))
+        {
+            return;
+        }
+        __sync_fetch_and_add(&http_sent, size);
+        offset += size;
+    }
+}
+
+static void* http_connection(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    http_respond(fd);
+    close(fd);
+    return NULL;
+}
+
+static void* http_accept(void* arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        int fd = accept(http_socket, NULL, NULL);
+        if (fd < 0)
+        {
+            break;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &http_connection, (void*)(intptr_t)fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+uint16_t bench_http_start(const uint8_t* data, uint64_t size)
+{
+    http_data = data;
+    http_size = size;
+    http_speed = 0;
+    http_sent = 0;
+
+    http_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (http_socket < 0)
+    {
+        return 0;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_size = sizeof(addr);
+
+    if (bind(http_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(http_socket, 64) != 0 ||
+        getsockname(http_socket, (struct sockaddr*)&addr, &addr_size) != 0 ||
+        pthread_create(&http_thread, NULL, &http_accept, NULL) != 0)
+    {
+        close(http_socket);
+        http_socket = -1;
+        return 0;
+    }
+
+    return ntohs(addr.sin_port);
+}
+
+void bench_http_stop(void)
+{
+    if (http_socket >= 0)
+    {
+        // wakes up accept, connections that are still open finish on their own
+        shutdown(http_socket, SHUT_RDWR);
+        pthread_join(http_thread, NULL);
+        close(http_socket);
+        http_socket = -1;
+    }
+}
+
+void bench_http_set_speed(uint32_t speed)
+{
+    http_speed = speed;
+}
+
+uint64_t bench_http_take_sent(void)
+{
+    return __sync_fetch_and_and(&http_sent, 0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// local HTTP/1.1 server for host tests and benchmarks, it serves one file from memory for any
+// path ending with ".pkg", supports Range requests and can limit speed of every connection
+
+// returns port on 127.0.0.1, 0 on failure
+uint16_t bench_http_start(const uint8_t* data, uint64_t size);
+void bench_http_stop(void);
+
+// bytes/s for every connection, 0 for unlimited
+void bench_http_set_speed(uint32_t speed);
+// returns body bytes sent since previous call
+uint64_t bench_http_take_sent(void);
@@ -0,0 +1,246 @@
+#include "pkgi_bench_pkg.h"
+#include "pkgi_aes128.h"
+#include "pkgi_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_PKG_META_OFFSET 0x400
+#define BENCH_PKG_ENC_OFFSET 0x1000
+#define BENCH_PKG_TAIL_SIZE 480
+
+#define BENCH_PKG_TYPE_FILE 3
+#define BENCH_PKG_TYPE_FOLDER 4
+
+// same key as key type 1 in pkgi_download.c
+static const uint8_t bench_pkg_key[] = { 0x07, 0xf2, 0xc6, 0x82, 0x90, 0xb5, 0x0d, 0x2c, 0x33, 0x81, 0x8d, 0x70, 0x9b, 0x60, 0xe6, 0x2b };
+
+static uint32_t bench_pkg_random;
+
+static uint32_t bench_pkg_next(void)
+{
+    bench_pkg_random = bench_pkg_random * 1103515245 + 12345;
+    return bench_pkg_random >> 8;
+}
+
+int bench_pkg_create(BenchPkg* pkg, uint32_t files, uint64_t big_size, uint32_t seed)
+{
+    memset(pkg, 0, sizeof(*pkg));
+    bench_pkg_random = seed;
+
+    uint32_t folders = 1 + files / 8;
+    pkg->count = folders + files;
+    pkg->names = calloc(pkg->count, sizeof(*pkg->names));
+    pkg->offsets = calloc(pkg->count, sizeof(*pkg->offsets));
+    pkg->sizes = calloc(pkg->count, sizeof(*pkg->sizes));
+    pkg->types = calloc(pkg->count, sizeof(*pkg->types));
+    if (!pkg->names || !pkg->offsets || !pkg->sizes || !pkg->types)
+    {
+        bench_pkg_free(pkg);
+        return 0;
+    }
+
+    char name[256];
+    for (uint32_t i = 0; i < folders; i++)
+    {
+        if (i == 0)
+        {
+            snprintf(name, sizeof(name), "sce_sys");
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "data/d%02u/sub%u", i, i % 3);
+        }
+        pkg->names[i] = strdup(name);
+        pkg->types[i] = BENCH_PKG_TYPE_FOLDER;
+    }
+
+    // mostly small files, like in real games
+    for (uint32_t i = 0; i < files; i++)
+    {
+        uint32_t index = folders + i;
+        if (i == 0)
+        {
+            snprintf(name, sizeof(name), "eboot.bin");
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%s/f%04u.bin", pkg->names[bench_pkg_next() % folders], i);
+        }
+        pkg->names[index] = strdup(name);
+        pkg->types[index] = BENCH_PKG_TYPE_FILE;
+
+        uint32_t kind = bench_pkg_next() % 100;
+        pkg->sizes[index] = kind < 70 ? bench_pkg_next() % 5000 : kind < 95 ? bench_pkg_next() % 300000 : bench_pkg_next() % 3000000;
+        if (i == 1 && big_size != 0)
+        {
+            pkg->sizes[index] = big_size;
+        }
+    }
+
+    // index entries are followed by names, every name is aligned to 16 bytes
+    uint32_t index_size = pkg->count * 32;
+    for (uint32_t i = 0; i < pkg->count; i++)
+    {
+        index_size += (uint32_t)(strlen(pkg->names[i]) + 15) & ~15;
+    }
+
+    uint64_t enc_size = index_size;
+    for (uint32_t i = 0; i < pkg->count; i++)
+    {
+        if (pkg->types[i] == BENCH_PKG_TYPE_FILE)
+        {
+            pkg->offsets[i] = enc_size;
+            enc_size += (pkg->sizes[i] + 15) & ~15ULL;
+        }
+    }
+
+    pkg->enc_offset = BENCH_PKG_ENC_OFFSET;
+    pkg->size = pkg->enc_offset + enc_size + BENCH_PKG_TAIL_SIZE;
+    pkg->data = calloc(1, pkg->size);
+    pkg->plain = calloc(1, enc_size);
+    if (!pkg->data || !pkg->plain)
+    {
+        bench_pkg_free(pkg);
+        return 0;
+    }
+
+    uint8_t* header = pkg->data;
+    set32be(header, 0x7f504b47);
+    set32be(header + 8, BENCH_PKG_META_OFFSET);
+    set32be(header + 12, 2);
+    set32be(header + 20, pkg->count);
+    set64be(header + 24, pkg->size);
+    set64be(header + 32, pkg->enc_offset);
+    set64be(header + 40, enc_size);
+    memcpy(header + 0x30, BENCH_PKG_CONTENT, sizeof(BENCH_PKG_CONTENT) - 1);
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        header[0x70 + i] = (uint8_t)bench_pkg_next();
+    }
+    set32be(header + 0xc0, 0x7f657874);
+    header[0xe7] = 1;
+
+    // content type 21 is main package, entry 13 points to file index
+    uint8_t* meta = pkg->data + BENCH_PKG_META_OFFSET;
+    set32be(meta, 2);
+    set32be(meta + 4, 8);
+    set32be(meta + 8, 21);
+    set32be(meta + 16, 13);
+    set32be(meta + 20, 8);
+    set32be(meta + 24, 0);
+    set32be(meta + 28, index_size);
+    for (uint64_t i = BENCH_PKG_META_OFFSET + 32; i < pkg->enc_offset; i++)
+    {
+        pkg->data[i] = (uint8_t)bench_pkg_next();
+    }
+
+    uint32_t name_offset = pkg->count * 32;
+    for (uint32_t i = 0; i < pkg->count; i++)
+    {
+        uint32_t name_size = (uint32_t)strlen(pkg->names[i]);
+        uint8_t* entry = pkg->plain + 32 * i;
+        set32be(entry, name_offset);
+        set32be(entry + 4, name_size);
+        set64be(entry + 8, pkg->offsets[i]);
+        set64be(entry + 16, pkg->sizes[i]);
+        entry[27] = pkg->types[i];
+        memcpy(pkg->plain + name_offset, pkg->names[i], name_size);
+        name_offset += (name_size + 15) & ~15;
+
+        for (uint64_t j = 0; j < pkg->sizes[i]; j++)
+        {
+            pkg->plain[pkg->offsets[i] + j] = (uint8_t)bench_pkg_next();
+        }
+    }
+
+    memcpy(pkg->data + pkg->enc_offset, pkg->plain, enc_size);
+    for (uint64_t i = pkg->enc_offset + enc_size; i < pkg->size; i++)
+    {
+        pkg->data[i] = (uint8_t)bench_pkg_next();
+    }
+
+    aes128_ctx aes;
+    aes128_ctr_init(&aes, bench_pkg_key);
+    for (uint64_t offset = 0; offset < enc_size; offset += 1024 * 1024)
+    {
+        uint32_t size = enc_size - offset < 1024 * 1024 ? (uint32_t)(enc_size - offset) : 1024 * 1024;
+        aes128_ctr(&aes, header + 0x70, offset, pkg->data + pkg->enc_offset + offset, size);
+    }
+
+    sha256_ctx sha;
+    sha256_init(&sha);
+    for (uint64_t offset = 0; offset < pkg->size; offset += 1024 * 1024)
+    {
+        uint32_t size = pkg->size - offset < 1024 * 1024 ? (uint32_t)(pkg->size - offset) : 1024 * 1024;
+        sha256_update(&sha, pkg->data + offset, size);
+    }
+    sha256_finish(&sha, pkg->digest);
+
+    return 1;
+}
+
+void bench_pkg_free(BenchPkg* pkg)
+{
+    if (pkg->names)
+    {
+        for (uint32_t i = 0; i < pkg->count; i++)
+        {
+            free(pkg->names[i]);
+        }
+    }
+    free(pkg->names);
+    free(pkg->offsets);
+    free(pkg->sizes);
+    free(pkg->types);
+    free(pkg->data);
+    free(pkg->plain);
+    memset(pkg, 0, sizeof(*pkg));
+}
+
+int bench_pkg_verify(const BenchPkg* pkg, const char* folder)
+{
+    uint8_t buffer[64 * 1024];
+    for (uint32_t i = 0; i < pkg->count; i++)
+    {
+        if (pkg->types[i] != BENCH_PKG_TYPE_FILE)
+        {
+            continue;
+        }
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", folder, pkg->names[i]);
+        FILE* f = fopen(path, "rb");
+        if (!f)
+        {
+            printf("%s is missing\n", path);
+            return 0;
+        }
+
+        uint64_t offset = 0;
+        int same = 1;
+        for (;;)
+        {
+            size_t read = fread(buffer, 1, sizeof(buffer), f);
+            if (read == 0)
+            {
+                break;
+            }
+            if (offset + read > pkg->sizes[i] || memcmp(buffer, pkg->plain + pkg->offsets[i] + offset, read) != 0)
+            {
+                same = 0;
+                break;
+            }
+            offset += read;
+        }
+        fclose(f);
+
+        if (!same || offset != pkg->sizes[i])
+        {
+            printf("%s is different at %llu offset\n", path, (unsigned long long)offset);
+            return 0;
+        }
+    }
+    return 1;
+}
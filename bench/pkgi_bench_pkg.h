@@ -0,0 +1,28 @@
+#pragma once
+
+#include "pkgi_sha256.h"
+
+#include <stdint.h>
+
+// synthetic pkg with folders and encrypted files for host download tests and benchmarks
+#define BENCH_PKG_CONTENT "UP0000-PCSE00000_00-0000000000000000"
+#define BENCH_PKG_TITLE "PCSE00000"
+
+typedef struct {
+    uint8_t* data;  // whole pkg
+    uint8_t* plain; // decrypted body, files are compared to it
+    uint64_t size;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint64_t enc_offset;
+    uint32_t count; // index entries
+    char** names;
+    uint64_t* offsets; // in plain body
+    uint64_t* sizes;
+    uint8_t* types;
+} BenchPkg;
+
+// second file is big_size bytes when it is not 0, rest of files have random sizes up to 3MB
+int bench_pkg_create(BenchPkg* pkg, uint32_t files, uint64_t big_size, uint32_t seed);
+void bench_pkg_free(BenchPkg* pkg);
+// compares installed files in folder with pkg, prints first difference
+int bench_pkg_verify(const BenchPkg* pkg, const char* folder);
@@ -0,0 +1,771 @@
+// POSIX platform layer, so crypto, zRIF and download code can run on host without Vita SDK
+
+#include "pkgi.h"
+#include "pkgi_dialog.h"
+#include "pkgi_posix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+// same limit as on Vita, download uses one request per connection
+#define PKGI_POSIX_MAX_HTTP 16
+#define PKGI_POSIX_HEADER_SIZE 4096
+
+struct pkgi_http
+{
+    int used;
+    int local;
+    int fd;           // local file or socket
+    uint64_t offset;  // local file offset to read next
+    uint64_t size;    // local file size from requested offset
+    int status;
+    int64_t length;   // content length of http response, 0 if it is unknown
+    uint8_t body[PKGI_POSIX_HEADER_SIZE]; // body bytes received together with headers
+    uint32_t body_offset;
+    uint32_t body_size;
+};
+
+static pkgi_http posix_http[PKGI_POSIX_MAX_HTTP];
+static pthread_mutex_t posix_dialog_lock = PTHREAD_MUTEX_INITIALIZER;
+static char posix_folder[256] = "pkgi_temp";
+static int posix_map = 1;
+
+void pkgi_posix_set_folder(const char* folder)
+{
+    snprintf(posix_folder, sizeof(posix_folder), "%s", folder);
+}
+
+void pkgi_posix_set_map(int enabled)
+{
+    posix_map = enabled;
+}
+
+void pkgi_log(const char* msg, ...)
+{
+    va_list args;
+    va_start(args, msg);
+    vfprintf(stderr, msg, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+int pkgi_snprintf(char* buffer, uint32_t size, const char* msg, ...)
+{
+    va_list args;
+    va_start(args, msg);
+    int len = vsnprintf(buffer, size, msg, args);
+    va_end(args);
+    return len < (int)size ? len : (int)size - 1;
+}
+
+void pkgi_vsnprintf(char* buffer, uint32_t size, const char* msg, va_list args)
+{
+    vsnprintf(buffer, size, msg, args);
+}
+
+char* pkgi_strstr(const char* str, const char* sub)
+{
+    return strstr(str, sub);
+}
+
+int pkgi_stricontains(const char* str, const char* sub)
+{
+    return strcasestr(str, sub) != NULL;
+}
+
+int pkgi_stricmp(const char* a, const char* b)
+{
+    return strcasecmp(a, b);
+}
+
+void pkgi_strncpy(char* dst, uint32_t size, const char* src)
+{
+    snprintf(dst, size, "%s", src);
+}
+
+char* pkgi_strrchr(const char* str, char ch)
+{
+    return strrchr(str, ch);
+}
+
+void pkgi_memcpy(void* dst, const void* src, uint32_t size)
+{
+    memcpy(dst, src, size);
+}
+
+void pkgi_memmove(void* dst, const void* src, uint32_t size)
+{
+    memmove(dst, src, size);
+}
+
+int pkgi_memequ(const void* a, const void* b, uint32_t size)
+{
+    return memcmp(a, b, size) == 0;
+}
+
+void* pkgi_malloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+void pkgi_free(void* ptr)
+{
+    free(ptr);
+}
+
+// there is no UI on host, dialogs only keep their state
+int pkgi_ok_button(void)
+{
+    return 0;
+}
+
+int pkgi_cancel_button(void)
+{
+    return 0;
+}
+
+void pkgi_dialog_lock(void)
+{
+    pthread_mutex_lock(&posix_dialog_lock);
+}
+
+void pkgi_dialog_unlock(void)
+{
+    pthread_mutex_unlock(&posix_dialog_lock);
+}
+
+void pkgi_clip_set(int x, int y, int w, int h)
+{
+    PKGI_UNUSED(x);
+    PKGI_UNUSED(y);
+    PKGI_UNUSED(w);
+    PKGI_UNUSED(h);
+}
+
+void pkgi_clip_remove(void)
+{
+}
+
+void pkgi_draw_rect(int x, int y, int w, int h, uint32_t color)
+{
+    PKGI_UNUSED(x);
+    PKGI_UNUSED(y);
+    PKGI_UNUSED(w);
+    PKGI_UNUSED(h);
+    PKGI_UNUSED(color);
+}
+
+void pkgi_draw_text(int x, int y, uint32_t color, const char* text)
+{
+    PKGI_UNUSED(x);
+    PKGI_UNUSED(y);
+    PKGI_UNUSED(color);
+    PKGI_UNUSED(text);
+}
+
+int pkgi_text_width(const char* text)
+{
+    return (int)strlen(text) * 8;
+}
+
+int pkgi_text_height(const char* text)
+{
+    PKGI_UNUSED(text);
+    return 16;
+}
+
+uint64_t pkgi_get_free_space(void)
+{
+    struct statvfs info;
+    if (statvfs(posix_folder, &info) != 0)
+    {
+        return 0;
+    }
+    return (uint64_t)info.f_bavail * info.f_frsize;
+}
+
+int pkgi_check_free_space(uint64_t size)
+{
+    uint64_t free = pkgi_get_free_space();
+    if (size > free + 1024 * 1024)
+    {
+        char error[256];
+        pkgi_snprintf(error, sizeof(error), "pkg requires %llu bytes free space, but only %llu available", size, free);
+        pkgi_dialog_error(error);
+        return 0;
+    }
+    return 1;
+}
+
+const char* pkgi_get_config_folder(void)
+{
+    return posix_folder;
+}
+
+const char* pkgi_get_temp_folder(void)
+{
+    return posix_folder;
+}
+
+const char* pkgi_get_app_folder(void)
+{
+    return posix_folder;
+}
+
+uint32_t pkgi_time_msec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void* pkgi_posix_thread(void* arg)
+{
+    pkgi_thread_entry* start = (pkgi_thread_entry*)arg;
+    start();
+    return NULL;
+}
+
+int pkgi_start_thread(const char* name, pkgi_thread_entry* start)
+{
+    PKGI_UNUSED(name);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &pkgi_posix_thread, (void*)start) != 0)
+    {
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+
+void pkgi_sleep(uint32_t msec)
+{
+    usleep(msec * 1000);
+}
+
+void* pkgi_sema_create(const char* name, uint32_t count, uint32_t max)
+{
+    PKGI_UNUSED(name);
+    PKGI_UNUSED(max);
+    sem_t* sema = malloc(sizeof(*sema));
+    if (sema && sem_init(sema, 0, count) != 0)
+    {
+        free(sema);
+        return NULL;
+    }
+    return sema;
+}
+
+void pkgi_sema_wait(void* sema)
+{
+    while (sem_wait(sema) != 0)
+    {
+    }
+}
+
+int pkgi_sema_poll(void* sema)
+{
+    return sem_trywait(sema) == 0;
+}
+
+void pkgi_sema_signal(void* sema)
+{
+    sem_post(sema);
+}
+
+void pkgi_sema_destroy(void* sema)
+{
+    sem_destroy(sema);
+    free(sema);
+}
+
+// file handles are fd + 1, so fd 0 is not NULL
+static void* posix_handle(int fd)
+{
+    return fd < 0 ? NULL : (void*)(intptr_t)(fd + 1);
+}
+
+static int posix_fd(void* f)
+{
+    return (int)(intptr_t)f - 1;
+}
+
+int pkgi_load(const char* name, void* data, uint32_t max)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int total = 0;
+    while ((uint32_t)total != max)
+    {
+        ssize_t read_size = read(fd, (uint8_t*)data + total, max - total);
+        if (read_size < 0)
+        {
+            total = -1;
+            break;
+        }
+        if (read_size == 0)
+        {
+            break;
+        }
+        total += (int)read_size;
+    }
+
+    close(fd);
+    return total;
+}
+
+int pkgi_save(const char* name, const void* data, uint32_t size)
+{
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    int ok = 1;
+    const uint8_t* data8 = data;
+    while (size != 0)
+    {
+        ssize_t written = write(fd, data8, size);
+        if (written <= 0)
+        {
+            ok = 0;
+            break;
+        }
+        data8 += written;
+        size -= (uint32_t)written;
+    }
+
+    close(fd);
+    return ok;
+}
+
+static pkgi_http* pkgi_http_alloc(void)
+{
+    for (uint32_t i = 0; i < PKGI_POSIX_MAX_HTTP; i++)
+    {
+        if (__sync_lock_test_and_set(&posix_http[i].used, 1) == 0)
+        {
+            return posix_http + i;
+        }
+    }
+
+    LOG("too many simultaneous http requests");
+    return NULL;
+}
+
+static void pkgi_http_free(pkgi_http* http)
+{
+    __sync_lock_release(&http->used);
+}
+
+// only plain http to host[:port] is supported, enough for local test server
+static int pkgi_http_send(pkgi_http* http, const char* url, uint64_t offset, uint64_t end)
+{
+    if (strncmp(url, "http://", 7) != 0)
+    {
+        LOG("unsupported url %s", url);
+        return 0;
+    }
+
+    char host[256];
+    const char* host_start = url + 7;
+    const char* path = strchr(host_start, '/');
+    if (!path)
+    {
+        path = host_start + strlen(host_start);
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(path - host_start), host_start);
+
+    const char* port = "80";
+    char* colon = strrchr(host, ':');
+    if (colon)
+    {
+        *colon = 0;
+        port = colon + 1;
+    }
+
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addr;
+    if (getaddrinfo(host, port, &hints, &addr) != 0)
+    {
+        LOG("cannot resolve %s", host);
+        return 0;
+    }
+
+    http->fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (http->fd < 0 || connect(http->fd, addr->ai_addr, addr->ai_addrlen) != 0)
+    {
+        LOG("cannot connect to %s:%s", host, port);
+        if (http->fd >= 0)
+        {
+            close(http->fd);
+        }
+        freeaddrinfo(addr);
+        return 0;
+    }
+    freeaddrinfo(addr);
+
+    char request[1024];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n", path[0] ? path : "/", host);
+    if (end != 0)
+    {
+        len += snprintf(request + len, sizeof(request) - len, "Range: bytes=%llu-%llu\r\n", (unsigned long long)offset, (unsigned long long)end - 1);
+    }
+    else if (offset != 0)
+    {
+        len += snprintf(request + len, sizeof(request) - len, "Range: bytes=%llu-\r\n", (unsigned long long)offset);
+    }
+    len += snprintf(request + len, sizeof(request) - len, "\r\n");
+
+    if (send(http->fd, request, len, MSG_NOSIGNAL) != len)
+    {
+        LOG("cannot send http request");
+        close(http->fd);
+        return 0;
+    }
+
+    // headers are read in one buffer, bytes after them are first bytes of body
+    char headers[PKGI_POSIX_HEADER_SIZE + 1];
+    uint32_t received = 0;
+    char* body = NULL;
+    while (!body && received < PKGI_POSIX_HEADER_SIZE)
+    {
+        ssize_t read_size = recv(http->fd, headers + received, PKGI_POSIX_HEADER_SIZE - received, 0);
+        if (read_size <= 0)
+        {
+            break;
+        }
+        received += (uint32_t)read_size;
+        headers[received] = 0;
+        body = strstr(headers, "\r\n\r\n");
+    }
+    if (!body)
+    {
+        LOG("cannot receive http response headers");
+        close(http->fd);
+        return 0;
+    }
+    body += 4;
+
+    http->status = 0;
+    sscanf(headers, "HTTP/%*s %d", &http->status);
+
+    http->length = 0;
+    const char* length = strcasestr(headers, "\r\nContent-Length:");
+    if (length && length < body)
+    {
+        long long value;
+        if (sscanf(length + 17, " %lld", &value) == 1)
+        {
+            http->length = value;
+        }
+    }
+
+    http->body_offset = 0;
+    http->body_size = received - (uint32_t)(body - headers);
+    memcpy(http->body, body, http->body_size);
+    return 1;
+}
+
+pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
+{
+    pkgi_http* http = pkgi_http_alloc();
+    if (!http)
+    {
+        return NULL;
+    }
+
+    http->fd = -1;
+    if (content)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s%s", pkgi_get_temp_folder(), strrchr(url, '/'));
+        http->fd = open(path, O_RDONLY);
+        if (http->fd < 0)
+        {
+            LOG("%s not found, trying shorter path", path);
+            snprintf(path, sizeof(path), "%s/%s.pkg", pkgi_get_temp_folder(), content);
+            http->fd = open(path, O_RDONLY);
+        }
+    }
+
+    if (http->fd >= 0)
+    {
+        struct stat st;
+        if (fstat(http->fd, &st) != 0 || (uint64_t)st.st_size < offset)
+        {
+            close(http->fd);
+            pkgi_http_free(http);
+            return NULL;
+        }
+
+        // same as http response, local file is read from requested offset
+        http->local = 1;
+        http->offset = offset;
+        http->size = st.st_size - offset;
+        return http;
+    }
+
+    http->local = 0;
+    if (!pkgi_http_send(http, url, offset, 0))
+    {
+        pkgi_http_free(http);
+        return NULL;
+    }
+    return http;
+}
+
+pkgi_http* pkgi_http_get_range(const char* url, uint64_t offset, uint64_t end)
+{
+    pkgi_http* http = pkgi_http_alloc();
+    if (!http)
+    {
+        return NULL;
+    }
+
+    http->local = 0;
+    if (!pkgi_http_send(http, url, offset, end))
+    {
+        pkgi_http_free(http);
+        return NULL;
+    }
+    return http;
+}
+
+int pkgi_http_is_local(pkgi_http* http)
+{
+    return http->local;
+}
+
+int pkgi_http_response_length(pkgi_http* http, int64_t* length)
+{
+    if (http->local)
+    {
+        *length = (int64_t)http->size;
+        return 1;
+    }
+
+    LOG("http status code = %d", http->status);
+    if (http->status != 200 && http->status != 206)
+    {
+        return 0;
+    }
+
+    *length = http->length;
+    return 1;
+}
+
+int pkgi_http_read(pkgi_http* http, void* buffer, uint32_t size)
+{
+    if (http->local)
+    {
+        ssize_t read_size = pread(http->fd, buffer, size, http->offset);
+        if (read_size > 0)
+        {
+            http->offset += read_size;
+        }
+        return (int)read_size;
+    }
+
+    if (http->body_offset != http->body_size)
+    {
+        uint32_t count = http->body_size - http->body_offset;
+        if (count > size)
+        {
+            count = size;
+        }
+        memcpy(buffer, http->body + http->body_offset, count);
+        http->body_offset += count;
+        return (int)count;
+    }
+
+    ssize_t read_size = recv(http->fd, buffer, size, 0);
+    if (read_size < 0)
+    {
+        LOG("recv failed, errno=%d", errno);
+    }
+    return (int)read_size;
+}
+
+void pkgi_http_close(pkgi_http* http)
+{
+    close(http->fd);
+    pkgi_http_free(http);
+}
+
+int pkgi_mkdir(const char* path)
+{
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+int pkgi_mkdirs(char* path)
+{
+    char* ptr = path;
+    while (*ptr)
+    {
+        while (*ptr && *ptr != '/')
+        {
+            ptr++;
+        }
+        char last = *ptr;
+        *ptr = 0;
+        if (path[0] && mkdir(path, 0777) != 0 && errno != EEXIST)
+        {
+            *ptr = last;
+            return 0;
+        }
+        *ptr = last;
+        if (last == 0)
+        {
+            break;
+        }
+        ptr++;
+    }
+    return 1;
+}
+
+void pkgi_rm(const char* file)
+{
+    if (unlink(file) != 0)
+    {
+        LOG("cannot delete %s file", file);
+    }
+}
+
+int pkgi_rename(const char* from, const char* to)
+{
+    // same as on Vita, existing file is not replaced
+    struct stat st;
+    if (stat(to, &st) == 0 || rename(from, to) != 0)
+    {
+        LOG("cannot rename %s to %s", from, to);
+        return 0;
+    }
+    return 1;
+}
+
+int64_t pkgi_get_size(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return -1;
+    }
+    return st.st_size;
+}
+
+void* pkgi_create(const char* path)
+{
+    return posix_handle(open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+}
+
+void* pkgi_openrw(const char* path)
+{
+    return posix_handle(open(path, O_RDWR));
+}
+
+int pkgi_preallocate(void* f, uint64_t size)
+{
+    // extends file to full size like on Vita, so download code is tested with same file sizes
+    int err = posix_fallocate(posix_fd(f), 0, (off_t)size);
+    if (err != 0)
+    {
+        LOG("cannot preallocate %llu bytes, err=%d", size, err);
+        return err != ENOSPC;
+    }
+    return 1;
+}
+
+void* pkgi_open(const char* path)
+{
+    return posix_handle(open(path, O_RDONLY));
+}
+
+const void* pkgi_map(const char* path, uint64_t* size)
+{
+    if (!posix_map)
+    {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    // empty file cannot be mapped
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size != 0)
+    {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    // file is read sequentially only once
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    *size = st.st_size;
+    return data;
+}
+
+void pkgi_unmap(const void* data, uint64_t size)
+{
+    munmap((void*)data, (size_t)size);
+}
+
+void* pkgi_append(const char* path)
+{
+    return posix_handle(open(path, O_WRONLY | O_CREAT | O_APPEND, 0666));
+}
+
+void pkgi_close(void* f)
+{
+    close(posix_fd(f));
+}
+
+int pkgi_read(void* f, void* buffer, uint32_t size)
+{
+    return (int)read(posix_fd(f), buffer, size);
+}
+
+int pkgi_write(void* f, const void* buffer, uint32_t size)
+{
+    return write(posix_fd(f), buffer, size) == (ssize_t)size;
+}
+
+int pkgi_sync(void* f)
+{
+    return fsync(posix_fd(f)) == 0;
+}
+
+int pkgi_seek(void* f, uint64_t offset)
+{
+    return lseek(posix_fd(f), (off_t)offset, SEEK_SET) >= 0;
+}
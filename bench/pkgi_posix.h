@@ -0,0 +1,8 @@
+#pragma once
+
+// host only functions of POSIX platform layer
+
+// folder used as temp, config and app folder, "pkgi_temp" in current folder by default
+void pkgi_posix_set_folder(const char* folder);
+// when disabled, pkgi_map fails like on Vita, so pkgi_reader reads file ahead in background thread
+void pkgi_posix_set_map(int enabled);
@@ -1,10 +1,11 @@
 #include "pkgi.h"
 #include "pkgi_db.h"
-#include "pkgi_zrif.h"
+#include "pkgi_rif.h"
 #include "pkgi_menu.h"
 #include "pkgi_config.h"
 #include "pkgi_dialog.h"
 #include "pkgi_download.h"
+#include "pkgi_sha256.h"
 #include "pkgi_utils.h"
 #include "pkgi_style.h"
 
@@ -58,8 +59,11 @@ static void pkgi_refresh_thread(void)
         url = PKGI_REFRESH_URL;
     }
 #endif
+    // validation pass reads items that are replaced by update
+    pkgi_rif_stop();
     if (pkgi_db_update(url, error_state, sizeof(error_state)))
     {
+        pkgi_rif_start();
         first_item = 0;
         selected_item = 0;
         state = StateUpdateDone;
@@ -102,13 +106,13 @@ static void pkgi_download_thread(void)
 
     uint8_t rif[PKGI_RIF_SIZE];
     char message[256];
-    if (item->zrif == NULL || pkgi_zrif_decode(item->zrif, rif, message, sizeof(message)))
+    if (item->zrif == NULL || pkgi_rif_get(item, rif, message, sizeof(message)))
     {
         // short delay to allow download dialog to animate smoothly
         pkgi_sleep(300);
 
         pkgi_lock_process();
-        if (pkgi_download(item->content, item->url, item->zrif == NULL ? NULL : rif, item->digest) && install(item->content))
+        if (pkgi_download(item->content, item->url, item->zrif == NULL ? NULL : rif, item->digest, &config) && install(item->content))
         {
             pkgi_snprintf(message, sizeof(message), "Successfully installed %s", item->name);
             pkgi_dialog_message(message);
@@ -306,7 +310,7 @@ static void pkgi_do_main(pkgi_input* input)
         {
             pkgi_draw_rect(0, y, VITA_WIDTH, font_height + PKGI_MAIN_ROW_PADDING - 1, PKGI_COLOR_SELECTED_BACKGROUND);
         }
-        uint32_t color = PKGI_COLOR_TEXT;
+        uint32_t color = pkgi_rif_broken(item) ? PKGI_COLOR_TEXT_ERROR : PKGI_COLOR_TEXT;
 
         char titleid[10];
         pkgi_memcpy(titleid, item->content + 7, 9);
@@ -396,6 +400,11 @@ static void pkgi_do_main(pkgi_input* input)
             LOG("[%.9s] %s - alreay installed", item->content + 7, item->name);
             pkgi_dialog_error("Already installed");
         }
+        else if (pkgi_rif_broken(item))
+        {
+            LOG("[%.9s] %s - zRIF is corrupted", item->content + 7, item->name);
+            pkgi_dialog_error("zRIF is corrupted, cannot install");
+        }
         else if (item->presence == PresenceIncomplete || (item->presence == PresenceMissing && pkgi_check_free_space(item->size)))
         {
             LOG("[%.9s] %s - starting to install", item->content + 7, item->name);
@@ -642,8 +651,12 @@ int main()
     pkgi_start();
     LOG("started");
 
+    // before any thread uses sha256
+    sha256_setup();
+
     pkgi_load_config(&config, refresh_url, sizeof(refresh_url));
     pkgi_dialog_init();
+    pkgi_rif_init();
 
     font_height = pkgi_text_height("M");
     avail_height = VITA_HEIGHT - 2 * (font_height + PKGI_MAIN_HLINE_EXTRA);
@@ -651,6 +664,7 @@ int main()
 
     if (pkgi_is_unsafe_mode())
     {
+        // list is loaded by same thread as refresh from menu, so zRIF pass starts after it too
         state = StateRefreshing;
         pkgi_start_thread("refresh_thread", &pkgi_refresh_thread);
     }
@@ -765,6 +779,8 @@ int main()
         pkgi_swap();
     }
 
+    pkgi_rif_stop();
+
     LOG("finished");
     pkgi_end();
 }
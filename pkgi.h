@@ -50,6 +50,8 @@ char* pkgi_strrchr(const char* str, char ch);
 void pkgi_memcpy(void* dst, const void* src, uint32_t size);
 void pkgi_memmove(void* dst, const void* src, uint32_t size);
 int pkgi_memequ(const void* a, const void* b, uint32_t size);
+void* pkgi_malloc(uint32_t size);
+void pkgi_free(void* ptr);
 
 int pkgi_is_unsafe_mode(void);
 
@@ -77,9 +79,16 @@ int pkgi_install(const char* titleid);
 uint32_t pkgi_time_msec();
 
 typedef void pkgi_thread_entry(void);
-void pkgi_start_thread(const char* name, pkgi_thread_entry* start);
+int pkgi_start_thread(const char* name, pkgi_thread_entry* start);
 void pkgi_sleep(uint32_t msec);
 
+void* pkgi_sema_create(const char* name, uint32_t count, uint32_t max);
+void pkgi_sema_wait(void* sema);
+// returns 1 if sema was acquired without waiting
+int pkgi_sema_poll(void* sema);
+void pkgi_sema_signal(void* sema);
+void pkgi_sema_destroy(void* sema);
+
 int pkgi_load(const char* name, void* data, uint32_t max);
 int pkgi_save(const char* name, const void* data, uint32_t size);
 
@@ -98,18 +107,33 @@ int pkgi_check_free_space(uint64_t http_length);
 typedef struct pkgi_http pkgi_http;
 
 pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset);
+// requests only [offset, end) bytes from url, never uses local pkg file
+pkgi_http* pkgi_http_get_range(const char* url, uint64_t offset, uint64_t end);
+int pkgi_http_is_local(pkgi_http* http);
 int pkgi_http_response_length(pkgi_http* http, int64_t* length);
 int pkgi_http_read(pkgi_http* http, void* buffer, uint32_t size);
 void pkgi_http_close(pkgi_http* http);
 
 int pkgi_mkdirs(char* path);
+// creates single folder, succeeds if it already exists
+int pkgi_mkdir(const char* path);
 void pkgi_rm(const char* file);
+// renames file, fails if new name already exists
+int pkgi_rename(const char* from, const char* to);
 int64_t pkgi_get_size(const char* path);
 
 // creates file (if it exists, truncates size to 0)
 void* pkgi_create(const char* path);
 // open existing file in read/write, fails if file does not exist
 void* pkgi_openrw(const char* path);
+// reserves storage for file that will have size bytes, returns 0 if there is not enough space,
+// on some platforms this also sets file size, so it must be called before any write to file
+int pkgi_preallocate(void* f, uint64_t size);
+// open existing file for reading only, same file can be opened multiple times
+void* pkgi_open(const char* path);
+// maps whole file to memory for reading, returns NULL if platform does not support it
+const void* pkgi_map(const char* path, uint64_t* size);
+void pkgi_unmap(const void* data, uint64_t size);
 // open file for writing, next write will append data to end of it
 void* pkgi_append(const char* path);
 
@@ -117,6 +141,10 @@ void pkgi_close(void* f);
 
 int pkgi_read(void* f, void* buffer, uint32_t size);
 int pkgi_write(void* f, const void* buffer, uint32_t size);
+// flushes written data to storage
+int pkgi_sync(void* f);
+// sets position for next read or write
+int pkgi_seek(void* f, uint64_t offset);
 
 // UI stuff
 typedef void* pkgi_texture;
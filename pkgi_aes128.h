@@ -2,13 +2,36 @@
 
 #include "pkgi_utils.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AES128_X86 1
+#endif
+
 typedef struct {
     uint32_t key[4*11] GCC_ALIGN(16);
 #if __ARM_NEON__
     uint8_t bskey[16*8*9] GCC_ALIGN(16);
 #endif
+#if !__ARM_NEON__
+    uint64_t bskey64[8*11] GCC_ALIGN(16); // bitsliced round keys for constant time implementation
+#endif
+#if AES128_X86
+    uint8_t nikey[16*11] GCC_ALIGN(16); // round keys in byte order for AES-NI
+#endif
+#if !__ARM_NEON__
+    int backend; // fastest ctr implementation that cpu supports
+#endif
 } aes128_ctx;
 
+#if !__ARM_NEON__
+// ctr implementation is chosen in aes128_ctr_init, aes128_init alone uses only table based code,
+// every backend with lower value than detected one is also supported by cpu, bitsliced one is
+// supported on every cpu, but it is slower than C, so it is never chosen by aes128_ctr_init
+#define AES128_BACKEND_C 0
+#define AES128_BACKEND_BITSLICE 1
+#define AES128_BACKEND_AESNI 2 // x86 only
+#define AES128_BACKEND_VAES 3  // x86 only
+#endif
+
 #define AES_BLOCK_SIZE 16
 
 void aes128_init(aes128_ctx* ctx, const uint8_t* key);
@@ -16,3 +39,15 @@ void aes128_encrypt(const aes128_ctx* ctx, const uint8_t* input, uint8_t* output
 
 void aes128_ctr_init(aes128_ctx* ctx, const uint8_t* key);
 void aes128_ctr(const aes128_ctx* ctx, const uint8_t* iv, uint64_t offset, uint8_t* buffer, uint32_t size);
+
+#if !__ARM_NEON__
+// forces other ctr implementation on ctx initialized with aes128_ctr_init, returns 0 if cpu does not support it
+int aes128_ctr_set_backend(aes128_ctx* ctx, int backend);
+#endif
+
+// starts worker threads used by aes128_ctr_parallel, returns how many are started
+uint32_t aes128_ctr_parallel_start(uint32_t threads);
+void aes128_ctr_parallel_stop(void);
+// same result as aes128_ctr, but large buffer is split between worker threads and calling thread,
+// only one thread can call it at the same time
+void aes128_ctr_parallel(const aes128_ctx* ctx, const uint8_t* iv, uint64_t offset, uint8_t* buffer, uint32_t size);
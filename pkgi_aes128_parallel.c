@@ -0,0 +1,136 @@
+#include "pkgi_aes128.h"
+#include "pkgi.h"
+
+#include <stddef.h>
+
+// every ctr block depends only on its offset, so buffer is split in parts at block boundaries,
+// worker threads decrypt all parts except the last one, which is decrypted by calling thread
+#define AES128_PARALLEL_MAX_THREADS 3
+
+// smaller parts are decrypted faster than it takes to wake up worker thread
+#define AES128_PARALLEL_MIN_PART (8 * 1024)
+
+typedef struct {
+    void* start; // signalled when part is assigned to thread
+    const aes128_ctx* ctx;
+    const uint8_t* iv;
+    uint64_t offset;
+    uint8_t* buffer;
+    uint32_t size;
+} Aes128Part;
+
+static Aes128Part parallel_parts[AES128_PARALLEL_MAX_THREADS];
+static uint32_t parallel_threads;
+static uint32_t parallel_starting; // part index for thread that is starting
+static volatile int parallel_quit;
+static void* parallel_done; // signalled when thread starts, finishes part or exits
+
+static void aes128_parallel_thread(void)
+{
+    Aes128Part* part = parallel_parts + parallel_starting;
+    pkgi_sema_signal(parallel_done);
+
+    for (;;)
+    {
+        pkgi_sema_wait(part->start);
+        if (parallel_quit)
+        {
+            break;
+        }
+
+        aes128_ctr(part->ctx, part->iv, part->offset, part->buffer, part->size);
+        pkgi_sema_signal(parallel_done);
+    }
+
+    pkgi_sema_signal(parallel_done);
+}
+
+uint32_t aes128_ctr_parallel_start(uint32_t threads)
+{
+    parallel_threads = 0;
+    parallel_quit = 0;
+
+    parallel_done = pkgi_sema_create("aes_done", 0, AES128_PARALLEL_MAX_THREADS);
+    if (!parallel_done)
+    {
+        return 0;
+    }
+
+    threads = min32(threads, AES128_PARALLEL_MAX_THREADS);
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        Aes128Part* part = parallel_parts + i;
+        part->start = pkgi_sema_create("aes_start", 0, 1);
+        if (!part->start)
+        {
+            break;
+        }
+
+        parallel_starting = i;
+        if (!pkgi_start_thread("aes_thread", &aes128_parallel_thread))
+        {
+            pkgi_sema_destroy(part->start);
+            part->start = NULL;
+            break;
+        }
+        pkgi_sema_wait(parallel_done);
+        parallel_threads++;
+    }
+
+    LOG("started %u aes threads", parallel_threads);
+    return parallel_threads;
+}
+
+void aes128_ctr_parallel_stop(void)
+{
+    parallel_quit = 1;
+    for (uint32_t i = 0; i < parallel_threads; i++)
+    {
+        pkgi_sema_signal(parallel_parts[i].start);
+        pkgi_sema_wait(parallel_done);
+        pkgi_sema_destroy(parallel_parts[i].start);
+        parallel_parts[i].start = NULL;
+    }
+    parallel_threads = 0;
+
+    if (parallel_done)
+    {
+        pkgi_sema_destroy(parallel_done);
+        parallel_done = NULL;
+    }
+}
+
+void aes128_ctr_parallel(const aes128_ctx* ctx, const uint8_t* iv, uint64_t offset, uint8_t* buffer, uint32_t size)
+{
+    uint32_t count = min32(parallel_threads + 1, size / AES128_PARALLEL_MIN_PART);
+    if (count <= 1)
+    {
+        aes128_ctr(ctx, iv, offset, buffer, size);
+        return;
+    }
+
+    // parts end on block boundaries, so no block is encrypted twice
+    uint32_t part_size = (size / count + AES_BLOCK_SIZE - 1) & ~(AES_BLOCK_SIZE - 1);
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < count - 1; i++)
+    {
+        uint64_t end = (offset + position + part_size) & ~((uint64_t)AES_BLOCK_SIZE - 1);
+
+        Aes128Part* part = parallel_parts + i;
+        part->ctx = ctx;
+        part->iv = iv;
+        part->offset = offset + position;
+        part->buffer = buffer + position;
+        part->size = (uint32_t)(end - part->offset);
+        pkgi_sema_signal(part->start);
+
+        position += part->size;
+    }
+
+    aes128_ctr(ctx, iv, offset + position, buffer + position, size - position);
+
+    for (uint32_t i = 0; i < count - 1; i++)
+    {
+        pkgi_sema_wait(parallel_done);
+    }
+}
@@ -1,5 +1,7 @@
 #include "pkgi_config.h"
 #include "pkgi.h"
+#include "pkgi_download.h"
+#include "pkgi_range.h"
 
 static char* skipnonws(char* text, char* end)
 {
@@ -106,6 +108,20 @@ static DbSortOrder parse_filter(char* value, uint32_t filter)
     return result;
 }
 
+static uint32_t parse_number(const char* value, uint32_t min, uint32_t max, uint32_t number)
+{
+    uint32_t result = 0;
+    while (*value >= '0' && *value <= '9')
+    {
+        result = result * 10 + (*value++ - '0');
+        if (result > max)
+        {
+            return number;
+        }
+    }
+    return *value == 0 && result >= min ? result : number;
+}
+
 void pkgi_load_config(Config* config, char* refresh_url, uint32_t refresh_len)
 {
     refresh_url[0] = 0;
@@ -113,6 +129,10 @@ void pkgi_load_config(Config* config, char* refresh_url, uint32_t refresh_len)
     config->order = SortAscending;
     config->filter = DbFilterAll;
     config->no_version_check = 0;
+    config->connections = PKGI_RANGE_DEFAULT_CONNECTIONS;
+    config->write_buffer = PKGI_WRITE_BUFFER_SIZE;
+    config->spool = 0;
+    config->preallocate = 0;
 
     char data[4096];
     char path[256];
@@ -174,6 +194,22 @@ void pkgi_load_config(Config* config, char* refresh_url, uint32_t refresh_len)
             {
                 config->no_version_check = 1;
             }
+            else if (pkgi_stricmp(key, "connections") == 0)
+            {
+                config->connections = parse_number(value, 1, PKGI_RANGE_MAX_CONNECTIONS, PKGI_RANGE_DEFAULT_CONNECTIONS);
+            }
+            else if (pkgi_stricmp(key, "write_buffer") == 0)
+            {
+                config->write_buffer = parse_number(value, 1, 64, PKGI_WRITE_BUFFER_SIZE);
+            }
+            else if (pkgi_stricmp(key, "spool") == 0)
+            {
+                config->spool = 1;
+            }
+            else if (pkgi_stricmp(key, "preallocate") == 0)
+            {
+                config->preallocate = 1;
+            }
         }
     }
     else
@@ -242,6 +278,22 @@ void pkgi_save_config(const Config* config, const char* update_url)
     {
         len += pkgi_snprintf(data + len, sizeof(data) - len, "no_version_check 1\n");
     }
+    if (config->connections != PKGI_RANGE_DEFAULT_CONNECTIONS)
+    {
+        len += pkgi_snprintf(data + len, sizeof(data) - len, "connections %u\n", config->connections);
+    }
+    if (config->write_buffer != PKGI_WRITE_BUFFER_SIZE)
+    {
+        len += pkgi_snprintf(data + len, sizeof(data) - len, "write_buffer %u\n", config->write_buffer);
+    }
+    if (config->spool)
+    {
+        len += pkgi_snprintf(data + len, sizeof(data) - len, "spool 1\n");
+    }
+    if (config->preallocate)
+    {
+        len += pkgi_snprintf(data + len, sizeof(data) - len, "preallocate 1\n");
+    }
 
     char path[256];
     pkgi_snprintf(path, sizeof(path), "%s/config.txt", pkgi_get_config_folder());
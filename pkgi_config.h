@@ -7,6 +7,10 @@ typedef struct Config {
     DbSortOrder order;
     uint32_t filter;
     int no_version_check;
+    uint32_t connections;
+    uint32_t write_buffer; // in MB
+    int spool; // first download whole pkg to temp folder, then install from it
+    int preallocate; // reserve space for every file before writing it
 } Config;
 
 void pkgi_load_config(Config* config, char* update_url, uint32_t update_len);
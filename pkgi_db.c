@@ -269,6 +269,7 @@ int pkgi_db_update(const char* update_url, char* error, uint32_t error_size)
         db[db_count].url = url;
         db[db_count].size = pkgi_strtoll(size);
         db[db_count].digest = pkgi_hexbytes(digest, SHA256_DIGEST_SIZE);
+        db[db_count].zrif_broken = 0;
         db_item[db_count] = db + db_count;
         db_count++;
 
@@ -461,6 +462,11 @@ DbItem* pkgi_db_get(uint32_t index)
     return index < db_item_count ? db_item[index] : NULL;
 }
 
+DbItem* pkgi_db_get_unfiltered(uint32_t index)
+{
+    return index < db_count ? db + index : NULL;
+}
+
 GameRegion pkgi_get_region(const char* content)
 {
     uint32_t first = get32le((uint8_t*)content + 7);
@@ -45,6 +45,7 @@ typedef struct {
     const char* url;
     const uint8_t* digest;
     int64_t size;
+    int zrif_broken; // set by zRIF validation pass in pkgi_rif, read with pkgi_rif_broken
 } DbItem;
 
 
@@ -66,5 +67,7 @@ void pkgi_db_configure(const char* search, const Config* config);
 uint32_t pkgi_db_count(void);
 uint32_t pkgi_db_total(void);
 DbItem* pkgi_db_get(uint32_t index);
+// index is up to pkgi_db_total, ignores search, filter and sorting
+DbItem* pkgi_db_get_unfiltered(uint32_t index);
 
 GameRegion pkgi_get_region(const char* content);
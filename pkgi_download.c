@@ -1,5 +1,11 @@
 #include "pkgi_download.h"
+#include "pkgi_config.h"
 #include "pkgi_dialog.h"
+#include "pkgi_keystream.h"
+#include "pkgi_meta.h"
+#include "pkgi_range.h"
+#include "pkgi_reader.h"
+#include "pkgi_ring.h"
 #include "pkgi.h"
 #include "pkgi_utils.h"
 #include "pkgi_aes128.h"
@@ -19,12 +25,65 @@ static const uint8_t pkg_vita_4[] = { 0xaf, 0x07, 0xfd, 0x59, 0x65, 0x25, 0x27,
 // temporary unpack folder ux0:pkgi/TITLE
 static char root[256];
 
+// in spool mode raw pkg is first downloaded to "ux0:pkgi/CONTENT.pkg.part", renamed to
+// "ux0:pkgi/CONTENT.pkg" when complete, and then installed from it same as any local pkg
+static char spool_file[256];
+
+// local pkg from temp folder that is installed, empty when pkg is downloaded from url
+static char local_file[256];
+
+// resume file has two checkpoint slots that are overwritten in turns, so if app is
+// killed while writing one of them, the other one is still valid
 static char resume_file[256];
 
+#define RESUME_MAGIC 0x52474b50
+#define RESUME_CHECKPOINT_SIZE (32 * 1024 * 1024) // checkpoint after this many bytes
+#define RESUME_CHECKPOINT_TIME (10 * 1000)        // or after this many msec
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;    // newest valid checkpoint is used, slot is sequence % 2
+    int32_t item_index;   // item that is being downloaded, -1 for head.bin or tail.bin
+    uint32_t reserved;
+    uint64_t offset;      // pkg offset up to which everything is downloaded and written
+    uint64_t item_offset; // encrypted_offset of item
+    sha256_ctx sha;       // hash of pkg up to offset
+    uint8_t check[SHA256_DIGEST_SIZE]; // sha256 of all fields above
+} ResumeCheckpoint;
+
+// every 4MB chunk of pkg is also hashed separately, so if pkg integrity fails, chunk hashes
+// can be compared to ones from "<url>.chunks" file on server and download can be resumed
+// from first corrupted chunk instead of from beginning
+static char chunks_file[256];
+
+#define CHUNK_SIZE (4 * 1024 * 1024)
+#define CHUNK_MANIFEST_MAX_SIZE (1024 * 1024)
+
+typedef struct {
+    ResumeCheckpoint start; // state at beginning of chunk
+    uint8_t digest[SHA256_DIGEST_SIZE];
+} ChunkRecord;
+
+static int chunks_enabled;
+static int chunks_repair; // if download should restart from resume file after failed integrity
+
+static ResumeCheckpoint resume;      // checkpoint from which download is resumed
+static uint64_t checkpoint_offset;   // offset of last checkpoint
+static uint32_t checkpoint_time;     // time of last checkpoint
+static uint32_t checkpoint_sequence; // sequence of last checkpoint
+static uint32_t checkpoint_count;    // checkpoints written by write thread
+static uint32_t checkpoint_msec;     // time spent writing them
+
 static pkgi_http* http;
 static const char* download_content;
 static const char* download_url;
 static int download_resume;
+static uint32_t download_connections;
+static int download_ranged; // encrypted files are downloaded with pkgi_range
+static int download_reading; // local pkg is read with pkgi_reader
+static uint64_t download_range_end; // where pkgi_range download stops
+static int download_skip_unused;    // no digest to check, so data not used by any file is not downloaded
+static int download_preallocate;    // space for every file is reserved when it is created
 
 static uint64_t initial_offset;  // where http download resumes
 static uint64_t download_offset; // pkg absolute offset
@@ -34,17 +93,127 @@ static uint8_t iv[AES_BLOCK_SIZE];
 static aes128_ctx aes;
 static sha256_ctx sha;
 
-static void* item_file;     // current file handle
+static void* item_file;     // current file handle, if opened by download thread
+static int item_open;       // if write thread has current file open
 static char item_name[256]; // current file name
 static char item_path[256]; // current file path
 static int item_index;      // current item
 
-// head.bin contents, kept in memory while downloading
-static uint8_t head[4 * 1024 * 1024];
-static uint32_t head_size;
-
-// temporary buffer for downloads
-static uint8_t down[64 * 1024];
+// pkg index parsed while head.bin is downloaded, it is decrypted only once
+typedef struct {
+    uint64_t offset;    // item_offset
+    uint64_t size;      // item_size
+    uint32_t name;      // offset in index_names
+    uint16_t name_size;
+    uint8_t type;
+} IndexItem;
+
+static IndexItem* index_items;
+static char* index_names; // decrypted zero terminated names of all items
+
+// download is pipelined - download thread receives data into blocks, hash thread hashes them,
+// crypto thread decrypts them, write thread saves them to files
+#define DOWNLOAD_BLOCK_SIZE (64 * 1024)
+#define DOWNLOAD_BLOCK_COUNT 8
+
+// how many next files are created by metadata worker before write thread needs them,
+// must be less than PKGI_META_AHEAD
+#define DOWNLOAD_CREATE_AHEAD 8
+
+// minimal size of unused data that is skipped with new http request instead of downloading it
+#define DOWNLOAD_SKIP_SIZE (256 * 1024)
+
+// files from local pkg are extracted by multiple threads, each one reads, decrypts and writes
+// next job - whole file, or part of it for big files
+#define EXTRACT_THREAD_COUNT 3
+#define EXTRACT_BUFFER_SIZE (256 * 1024)
+#define EXTRACT_RANGE_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+    uint32_t index; // item
+    uint64_t start; // range of item that is extracted
+    uint64_t end;
+} ExtractJob;
+
+static ExtractJob* extract_jobs;
+static uint32_t extract_job_count;
+static uint32_t extract_next;     // next job to extract
+static uint64_t extract_written;  // bytes written by all threads
+static volatile int extract_abort;
+static volatile int extract_failed;
+static char extract_error[256];
+
+static void* extract_lock; // protects extract_next, extract_written and extract_error
+static void* extract_done; // signalled when thread exits
+
+typedef enum {
+    BlockFolder, // take folder queued in pkgi_meta, path is in data
+    BlockCreate, // create file or take it from pkgi_meta, path is in data
+    BlockOpen,   // use already opened file, path is in data
+    BlockData,   // write data to file
+    BlockClose,  // close file
+    BlockCheckpoint, // append ResumeCheckpoint in data to resume file
+    BlockSync,  // signal pipeline_sync when everything before it is written
+    BlockQuit,  // same as sync, but stops threads
+} BlockType;
+
+typedef struct {
+    BlockType type;
+    void* file;           // for BlockOpen
+    int folders;          // for BlockCreate, if parent folders must be created
+    uint64_t reserve;     // for BlockCreate, bytes to preallocate or 0
+    int ahead;            // for BlockCreate, if file is queued in pkgi_meta
+    uint32_t size;        // downloaded bytes
+    uint32_t write;       // bytes to write to file
+    int encrypted;
+    uint64_t encrypted_offset; // offset in encrypted data of first byte
+    uint64_t offset;           // pkg offset of first byte
+    int32_t item_index;
+    uint64_t item_offset;      // encrypted_offset of item for first byte
+    int chunk;                 // if block finished chunk and chunk_record must be saved
+    ChunkRecord chunk_record;
+    uint32_t queued_msec;      // when download thread passed block to hash thread
+    uint8_t data[DOWNLOAD_BLOCK_SIZE] GCC_ALIGN(16);
+} DownloadBlock;
+
+static DownloadBlock blocks[DOWNLOAD_BLOCK_COUNT];
+static DownloadBlock* download_block; // free block owned by download thread
+
+static pkgi_ring ring_free;   // write thread -> download thread
+static pkgi_ring ring_hash;   // download thread -> hash thread
+static pkgi_ring ring_crypto; // hash thread -> crypto thread
+static pkgi_ring ring_write;  // crypto thread -> write thread
+static void* pipeline_sync;
+static volatile int write_failed;
+
+// used only by hash thread
+static sha256_ctx chunk_sha;         // hash of current chunk
+static ResumeCheckpoint chunk_start; // state at beginning of current chunk
+static int chunk_valid;              // if current chunk is hashed from its beginning
+
+// crypto thread generates keystream ahead while it waits for downloaded data
+static pkgi_keystream keystream;
+
+// helper threads for decrypting data that was not prefetched, when download is faster than one core
+#define DOWNLOAD_AES_THREADS 2
+
+// crypto throughput measured on device, msec timer is sampled for every block, so rounding
+// errors average out over whole download
+static uint64_t hash_bytes;
+static uint32_t hash_blocks;
+static uint32_t hash_msec;
+static uint32_t hash_lag_msec;     // total time blocks waited in queue before hashing
+static uint32_t hash_lag_max_msec;
+static uint32_t crypto_decrypt_msec; // xor and inline decryption
+
+// write thread collects small files & writes to large files in this buffer,
+// so there is only one write per small file and multi-MB writes for large ones
+static uint8_t* write_buffer;
+static uint32_t write_buffer_size;
+static uint32_t write_pending;
+static void* write_file;
+static char write_path[256];
+static char write_error[256];
 
 // pkg header
 static uint32_t meta_offset;
@@ -142,528 +311,2112 @@ static void update_progress(void)
     }
 }
 
-static void download_start(void)
+static void checkpoint_digest(const ResumeCheckpoint* checkpoint, uint8_t* digest)
 {
-    LOG("resuming pkg download from %llu offset", download_offset);
-    download_resume = 0;
-    info_update = pkgi_time_msec() + 1000;
-    pkgi_dialog_set_progress_title("Downloading");
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const uint8_t*)checkpoint, offsetof(ResumeCheckpoint, check));
+    sha256_finish(&ctx, digest);
 }
 
-static int download_data(uint8_t* buffer, uint32_t size, int encrypted, int save)
+static void chunk_begin(DownloadBlock* block, uint32_t position)
 {
-    if (pkgi_dialog_is_cancelled())
+    if (chunk_valid)
     {
-        pkgi_save(resume_file, &sha, sizeof(sha));
-        return 0;
+        block->chunk = 1;
+        block->chunk_record.start = chunk_start;
+        sha256_finish(&chunk_sha, block->chunk_record.digest);
     }
 
-    update_progress();
+    chunk_start.magic = RESUME_MAGIC;
+    chunk_start.sequence = 1;
+    chunk_start.item_index = block->item_index;
+    chunk_start.reserved = 0;
+    chunk_start.offset = block->offset + position;
+    chunk_start.item_offset = block->encrypted ? block->item_offset + position : 0;
+    chunk_start.sha = sha;
+    checkpoint_digest(&chunk_start, chunk_start.check);
+
+    sha256_init(&chunk_sha);
+    chunk_valid = 1;
+}
 
-    if (download_resume)
+static void hash_block(DownloadBlock* block)
+{
+    block->chunk = 0;
+    if (!chunks_enabled)
     {
-        int read = pkgi_read(item_file, buffer, size);
-        if (read < 0)
-        {
-            char error[256];
-            pkgi_snprintf(error, sizeof(error), "failed to read file %s", item_path);
-            pkgi_dialog_error(error);
-            return -1;
-        }
+        sha256_update(&sha, block->data, block->size);
+        return;
+    }
 
-        if (read != 0)
+    // block is smaller than chunk, so it can start at most one new chunk
+    uint32_t position = 0;
+    while (position != block->size)
+    {
+        uint32_t chunk_offset = (uint32_t)((block->offset + position) % CHUNK_SIZE);
+        if (chunk_offset == 0)
         {
-            // this is only for non-encrypted files (head/tail) when resuming
-            download_offset += read;
-            return read;
+            chunk_begin(block, position);
         }
 
-        // not more data to read, need to start actual download
-        download_start();
+        // pkg and chunk hashes read same part of block while it is in cache
+        uint32_t size = min32(block->size - position, CHUNK_SIZE - chunk_offset);
+        sha256_update2(&sha, &chunk_sha, block->data + position, size);
+        position += size;
     }
+}
 
-    if (!http)
+// sha256 must see data before it is decrypted, but hashing runs on its own core, so hashing
+// of one block overlaps with decryption of previous one
+static void download_hash_thread(void)
+{
+    for (;;)
     {
-        initial_offset = download_offset;
-        LOG("requesting %s @ %llu", download_url, download_offset);
-        http = pkgi_http_get(download_url, download_content, download_offset);
-        if (!http)
-        {
-            pkgi_dialog_error("cannot send HTTP request");
-            return 0;
-        }
+        DownloadBlock* block = pkgi_ring_pop(&ring_hash);
 
-        int64_t http_length;
-        if (!pkgi_http_response_length(http, &http_length))
+        BlockType type = block->type;
+        if (type == BlockData)
         {
-            pkgi_dialog_error("HTTP request failed");
-            return 0;
+            uint32_t start = pkgi_time_msec();
+            uint32_t lag = start - block->queued_msec;
+            hash_lag_msec += lag;
+            hash_lag_max_msec = max32(hash_lag_max_msec, lag);
+
+            hash_block(block);
+            hash_msec += pkgi_time_msec() - start;
+            hash_bytes += block->size;
+            hash_blocks++;
         }
-        if (http_length < 0)
+        else if (type == BlockCheckpoint)
         {
-            pkgi_dialog_error("HTTP response has unknown length");
-            return 0;
+            ResumeCheckpoint* checkpoint = (ResumeCheckpoint*)block->data;
+            checkpoint->sha = sha;
         }
+        // block can be reused as soon as it is pushed, so its type is not read after that
+        pkgi_ring_push(&ring_crypto, block);
 
-        download_size = http_length + download_offset;
-
-        if (!pkgi_check_free_space(http_length))
+        if (type == BlockQuit)
         {
-            return 0;
+            break;
         }
-
-        LOG("http response length = %lld, total pkg size = %llu", http_length, download_size);
-        info_start = pkgi_time_msec();
-        info_update = pkgi_time_msec() + 500;
-    }
-
-    int read = pkgi_http_read(http, buffer, size);
-    if (read < 0)
-    {
-        char error[256];
-        pkgi_snprintf(error, sizeof(error), "HTTP download error 0x%08x", read);
-        pkgi_dialog_error(error);
-        pkgi_save(resume_file, &sha, sizeof(sha));
-        return -1;
-    }
-    else if (read == 0)
-    {
-        pkgi_dialog_error("HTTP connection closed");
-        pkgi_save(resume_file, &sha, sizeof(sha));
-        return -1;
-    }
-    download_offset += read;
-
-    sha256_update(&sha, buffer, read);
-
-    if (encrypted)
-    {
-        aes128_ctr(&aes, iv, encrypted_base + encrypted_offset, buffer, read);
-        encrypted_offset += read;
     }
+}
 
-    if (save)
+static void download_crypto_thread(void)
+{
+    for (;;)
     {
-        uint32_t write;
-        if (encrypted)
+        DownloadBlock* block;
+        while ((block = pkgi_ring_try_pop(&ring_crypto)) == NULL)
         {
-            write = (uint32_t)min64(decrypted_size, read);
-            decrypted_size -= write;
+            if (!pkgi_keystream_generate(&keystream))
+            {
+                block = pkgi_ring_pop(&ring_crypto);
+                break;
+            }
         }
-        else
+
+        BlockType type = block->type;
+        if (type == BlockData && block->encrypted)
         {
-            write = read;
+            uint32_t start = pkgi_time_msec();
+            pkgi_keystream_decrypt(&keystream, block->data, block->encrypted_offset, block->size);
+            crypto_decrypt_msec += pkgi_time_msec() - start;
         }
+        // block can be reused as soon as it is pushed, so its type is not read after that
+        pkgi_ring_push(&ring_write, block);
 
-        if (!pkgi_write(item_file, buffer, write))
+        if (type == BlockQuit)
         {
-            char error[256];
-            pkgi_snprintf(error, sizeof(error), "failed to write to %s", item_path);
-            pkgi_dialog_error(error);
-            return -1;
+            break;
         }
     }
-
-    return read;
 }
 
-// this includes creating of all the parent folders necessary to actually create file
-static int create_file(void)
+static void write_fail(const char* msg)
 {
-    char folder[256];
-    pkgi_strncpy(folder, sizeof(folder), item_path);
-    char* last = pkgi_strrchr(folder, '/');
-    *last = 0;
-
-    if (!pkgi_mkdirs(folder))
-    {
-        char error[256];
-        pkgi_snprintf(error, sizeof(error), "cannot create folder %s", folder);
-        pkgi_dialog_error(error);
-        return 1;
-    }
-
-    LOG("creating %s file", item_name);
-    item_file = pkgi_create(item_path);
-    if (!item_file)
-    {
-        char error[256];
-        pkgi_snprintf(error, sizeof(error), "cannot create file %s", item_name);
-        pkgi_dialog_error(error);
-        return 0;
-    }
-
-    return 1;
+    pkgi_snprintf(write_error, sizeof(write_error), "%s %s", msg, write_path);
+    LOG("%s", write_error);
+    write_failed = 1;
 }
 
-static int download_head(const uint8_t* rif)
+static void write_flush(void)
 {
-    LOG("downloading pkg head");
-
-    pkgi_strncpy(item_name, sizeof(item_name), "Preparing...");
-    pkgi_snprintf(item_path, sizeof(item_path), "%s/sce_sys/package/head.bin", root);
-
-    int result = 0;
-
-    if (download_resume)
+    if (write_pending != 0 && !write_failed)
     {
-        item_file = pkgi_openrw(item_path);
-        if (item_file)
-        {
-            LOG("trying to resume %s file", item_name);
-        }
-        else
+        if (!pkgi_write(write_file, write_buffer, write_pending))
         {
-            download_start();
+            write_fail("failed to write to");
         }
     }
+    write_pending = 0;
+}
 
-    if (!download_resume)
+static void write_create(int folders, uint64_t reserve)
+{
+    if (folders)
     {
-        if (!create_file())
+        char folder[256];
+        pkgi_strncpy(folder, sizeof(folder), write_path);
+        char* last = pkgi_strrchr(folder, '/');
+        *last = 0;
+
+        if (!pkgi_mkdirs(folder))
         {
-            char error[256];
-            pkgi_snprintf(error, sizeof(error), "cannot create %s", item_path);
-            pkgi_dialog_error(error);
-            goto bail;
+            write_fail("cannot create folder for");
+            return;
         }
     }
 
-    head_size = PKG_HEADER_SIZE + PKG_HEADER_EXT_SIZE;
-    uint32_t head_offset = 0;
-    while (head_offset != head_size)
+    write_file = pkgi_create(write_path);
+    if (!write_file)
     {
-        int size = download_data(head + head_offset, head_size - head_offset, 0, 1);
-        if (size <= 0)
-        {
-            goto bail;
-        }
-        head_offset += size;
+        write_fail("cannot create file");
     }
-
-    if (get32be(head) != 0x7f504b47 || get32be(head + PKG_HEADER_SIZE) != 0x7F657874)
+    else if (reserve != 0 && !pkgi_preallocate(write_file, reserve))
     {
-        pkgi_dialog_error("wrong pkg header");
-        goto bail;
+        write_fail("not enough free space for");
     }
+}
 
-    if (rif && !pkgi_memequ(rif + 0x10, head + 0x30, 0x30))
+static void write_data(const uint8_t* data, uint32_t size)
+{
+    if (write_failed || size == 0)
     {
-        pkgi_dialog_error("zRIF content id doesn't match pkg");
-        goto bail;
+        return;
     }
 
-    meta_offset = get32be(head + 8);
-    meta_count = get32be(head + 12);
-    index_count = get32be(head + 20);
-    total_size = get64be(head + 24);
-    enc_offset = get64be(head + 32);
-    enc_size = get64be(head + 40);
-    LOG("meta_offset=%u meta_count=%u index_count=%u total_size=%llu enc_offset=%llu enc_size=%llu",
-        meta_offset, meta_count, index_count, total_size, enc_offset, enc_size);
+    if (write_pending + size > write_buffer_size)
+    {
+        write_flush();
+    }
+    pkgi_memcpy(write_buffer + write_pending, data, size);
+    write_pending += size;
+}
 
-    if (enc_offset > sizeof(head))
+static void write_checkpoint(ResumeCheckpoint* checkpoint)
+{
+    if (write_failed)
     {
-        LOG("pkg file head is too large");
-        pkgi_dialog_error("pkg is not supported, head.bin is too big");
-        goto bail;
+        // data before checkpoint is not written
+        return;
     }
 
-    pkgi_memcpy(iv, head + 0x70, sizeof(iv));
+    uint32_t start = pkgi_time_msec();
 
-    uint8_t key[AES_BLOCK_SIZE];
-    int key_type = head[0xe7] & 7;
-    if (key_type == 1)
+    // data must be on storage before checkpoint that refers to it, files closed since
+    // previous checkpoint are synced by metadata worker before flush returns
+    pkgi_meta_flush();
+    if (write_file)
     {
-        pkgi_memcpy(key, pkg_psp_key, sizeof(key));
+        pkgi_sync(write_file);
     }
-    else if (key_type == 2)
+
+    checkpoint_digest(checkpoint, checkpoint->check);
+
+    void* f = pkgi_openrw(resume_file);
+    if (!f)
     {
-        aes128_ctx ctx;
-        aes128_init(&ctx, pkg_vita_2);
-        aes128_encrypt(&ctx, iv, key);
+        f = pkgi_create(resume_file);
     }
-    else if (key_type == 3)
+
+    if (!f ||
+        !pkgi_seek(f, (checkpoint->sequence % 2) * sizeof(*checkpoint)) ||
+        !pkgi_write(f, checkpoint, sizeof(*checkpoint)) ||
+        !pkgi_sync(f))
     {
-        aes128_ctx ctx;
-        aes128_init(&ctx, pkg_vita_3);
-        aes128_encrypt(&ctx, iv, key);
+        LOG("cannot save checkpoint to %s", resume_file);
     }
-    else if (key_type == 4)
+    if (f)
     {
-        aes128_ctx ctx;
-        aes128_init(&ctx, pkg_vita_4);
-        aes128_encrypt(&ctx, iv, key);
+        pkgi_close(f);
     }
 
-    aes128_ctr_init(&aes, key);
+    checkpoint_count++;
+    checkpoint_msec += pkgi_time_msec() - start;
+}
 
-    uint32_t target_size = (uint32_t)enc_offset;
-    while (head_size != target_size)
+static void write_chunk(const ChunkRecord* record)
+{
+    void* f = pkgi_openrw(chunks_file);
+    if (!f)
     {
-        int size = download_data(head + head_size, target_size - head_size, 0, 1);
-        if (size <= 0)
-        {
-            goto bail;
-        }
-        head_size += size;
+        f = pkgi_create(chunks_file);
     }
 
-    index_size = 0;
+    uint64_t index = record->start.offset / CHUNK_SIZE;
+    if (!f || !pkgi_seek(f, index * sizeof(*record)) || !pkgi_write(f, record, sizeof(*record)))
+    {
+        LOG("cannot save chunk %llu to %s", index, chunks_file);
+    }
+    if (f)
+    {
+        pkgi_close(f);
+    }
+}
 
-    uint32_t index_offset = 1;
-    uint32_t offset = meta_offset;
-    for (uint32_t i = 0; i < meta_count; i++)
+static void download_write_thread(void)
+{
+    for (;;)
     {
-        if (offset + 16 >= enc_offset)
+        DownloadBlock* block = pkgi_ring_pop(&ring_write);
+        BlockType type = block->type;
+        if (type == BlockFolder)
         {
-            pkgi_dialog_error("pkg file is too small or corrupted");
-            goto bail;
+            pkgi_strncpy(write_path, sizeof(write_path), (const char*)block->data);
+            void* unused;
+            const char* error = pkgi_meta_take(&unused);
+            if (error && !write_failed)
+            {
+                write_fail(error);
+            }
         }
-
-        uint32_t type = get32be(head + offset + 0);
-        uint32_t size = get32be(head + offset + 4);
-
-        if (type == 2)
+        else if (type == BlockCreate)
         {
-            uint32_t content_type = get32be(head + offset + 8);
-            if (content_type != 21)
+            pkgi_strncpy(write_path, sizeof(write_path), (const char*)block->data);
+            if (block->ahead)
             {
-                pkgi_dialog_error("pkg is not a main package");
-                goto bail;
+                // taken even after failure, so next results stay in order
+                const char* error = pkgi_meta_take(&write_file);
+                if (error && !write_failed)
+                {
+                    write_fail(error);
+                }
+            }
+            else if (!write_failed)
+            {
+                write_create(block->folders, block->reserve);
+            }
+        }
+        else if (type == BlockOpen)
+        {
+            pkgi_strncpy(write_path, sizeof(write_path), (const char*)block->data);
+            write_file = block->file;
+        }
+        else if (type == BlockData)
+        {
+            write_data(block->data, block->write);
+            if (block->chunk)
+            {
+                write_chunk(&block->chunk_record);
+            }
+        }
+        else if (type == BlockCheckpoint)
+        {
+            write_flush();
+            write_checkpoint((ResumeCheckpoint*)block->data);
+        }
+        else if (type == BlockClose)
+        {
+            write_flush();
+            if (write_file)
+            {
+                pkgi_meta_close(write_file);
+                write_file = NULL;
             }
         }
-        else if (type == 13)
+        else
+        {
+            write_flush();
+            pkgi_meta_flush();
+        }
+        pkgi_ring_push(&ring_free, block);
+
+        if (type == BlockSync || type == BlockQuit)
         {
-            index_offset = get32be(head + offset + 8);
-            index_size = get32be(head + offset + 12);
+            pkgi_sema_signal(pipeline_sync);
+        }
+        if (type == BlockQuit)
+        {
+            break;
         }
-        offset += 8 + size;
     }
+}
 
-    if (index_offset != 0 || index_size == 0)
+static DownloadBlock* download_get_block(void)
+{
+    if (!download_block)
     {
-        pkgi_dialog_error("pkg is missing encrypted file index");
-        goto bail;
+        download_block = pkgi_ring_pop(&ring_free);
     }
+    return download_block;
+}
+
+static void download_put_block(void)
+{
+    download_block->queued_msec = pkgi_time_msec();
+    pkgi_ring_push(&ring_hash, download_block);
+    download_block = NULL;
+}
+
+// waits until all downloaded data is hashed and written
+static int download_sync(void)
+{
+    DownloadBlock* block = download_get_block();
+    block->type = BlockSync;
+    download_put_block();
+    pkgi_sema_wait(pipeline_sync);
 
-    target_size = (uint32_t)(enc_offset + index_size);
-    if (target_size > sizeof(head))
+    if (write_failed)
     {
-        LOG("pkg file head is too large");
-        pkgi_dialog_error("pkg is not supported, head.bin is too big");
-        goto bail;
+        pkgi_dialog_error(write_error);
+        return 0;
     }
+    return 1;
+}
 
-    while (head_size != target_size)
+// checkpoint goes through pipeline, so it is saved only after all data before it is written
+static void download_checkpoint(void)
+{
+    if (download_resume)
     {
-        int size = download_data(head + head_size, target_size - head_size, 0, 1);
-        if (size <= 0)
-        {
-            goto bail;
-        }
-        head_size += size;
+        // resume file already has checkpoint from which download is resumed
+        return;
     }
 
-    LOG("head.bin downloaded");
-    result = 1;
+    DownloadBlock* block = download_get_block();
+    block->type = BlockCheckpoint;
 
-bail:
-    if (item_file)
-    {
-        pkgi_close(item_file);
-        item_file = NULL;
-    }
+    ResumeCheckpoint* checkpoint = (ResumeCheckpoint*)block->data;
+    checkpoint->magic = RESUME_MAGIC;
+    checkpoint->sequence = ++checkpoint_sequence;
+    checkpoint->item_index = item_index;
+    checkpoint->reserved = 0;
+    checkpoint->offset = download_offset;
+    checkpoint->item_offset = item_index < 0 ? 0 : encrypted_offset;
+    download_put_block();
 
-    return result;
+    checkpoint_offset = download_offset;
+    checkpoint_time = pkgi_time_msec();
 }
 
-static int download_files(void)
+static void download_save_resume(void)
 {
-    LOG("downloading encrypted files");
+    download_checkpoint();
+    download_sync();
+}
 
-    int result = 0;
+static int load_resume(void)
+{
+    ResumeCheckpoint checkpoints[2];
+    int loaded = pkgi_load(resume_file, checkpoints, sizeof(checkpoints));
+    if (loaded < (int)sizeof(checkpoints[0]))
+    {
+        return 0;
+    }
 
-    for (uint32_t index = 0; index < index_count; index++)
+    int found = 0;
+    for (uint32_t i = 0; i < (uint32_t)loaded / sizeof(checkpoints[0]); i++)
     {
-        uint8_t item[32];
-        pkgi_memcpy(item, head + enc_offset + sizeof(item) * index, sizeof(item));
-        aes128_ctr(&aes, iv, sizeof(item) * index, item, sizeof(item));
+        const ResumeCheckpoint* checkpoint = checkpoints + i;
 
-        uint32_t name_offset = get32be(item + 0);
-        uint32_t name_size = get32be(item + 4);
-        uint64_t item_offset = get64be(item + 8);
-        uint64_t item_size = get64be(item + 16);
-        uint8_t type = item[27];
+        uint8_t check[SHA256_DIGEST_SIZE];
+        checkpoint_digest(checkpoint, check);
 
-        if (name_size > sizeof(item_name) - 1 || enc_offset + name_offset + name_size > total_size)
+        if (checkpoint->magic != RESUME_MAGIC || !pkgi_memequ(check, checkpoint->check, sizeof(check)))
         {
-            pkgi_dialog_error("pkg file is too small or corrupted");
-            goto bail;
+            LOG("checkpoint %u in resume file is not valid", i);
+            continue;
         }
 
-        pkgi_memcpy(item_name, head + enc_offset + name_offset, name_size);
-        aes128_ctr(&aes, iv, name_offset, (uint8_t*)item_name, name_size);
-        item_name[name_size] = 0;
-
-        LOG("[%u/%u] %s item_offset=%llu item_size=%llu type=%u", item_index + 1, index_count, item_name, item_offset, item_size, type);
-
-        if (type == 4 || type == 18)
+        if (!found || checkpoint->sequence > resume.sequence)
         {
-            continue;
+            resume = *checkpoint;
+            found = 1;
         }
+    }
 
-        pkgi_snprintf(item_path, sizeof(item_path), "%s/%s", root, item_name);
+    return found;
+}
 
-        uint64_t encrypted_size = (item_size + AES_BLOCK_SIZE - 1) & ~((uint64_t)AES_BLOCK_SIZE - 1);
-        decrypted_size = item_size;
-        encrypted_base = item_offset;
-        encrypted_offset = 0;
-        item_index = index;
+static void resume_failed(void)
+{
+    LOG("downloaded files do not match resume file, removing it");
+    pkgi_rm(resume_file);
+    pkgi_dialog_error("cannot resume download, try downloading again");
+}
 
-        if (download_resume)
-        {
-            if (pkgi_dialog_is_cancelled())
-            {
-                goto bail;
-            }
+// file is created by write thread or metadata worker, so download thread never waits for it
+static void create_file(int folders, uint64_t size, int ahead)
+{
+    LOG("creating %s file", item_name);
+
+    DownloadBlock* block = download_get_block();
+    block->type = BlockCreate;
+    block->folders = folders;
+    block->reserve = download_preallocate ? size : 0;
+    block->ahead = ahead;
+    pkgi_strncpy((char*)block->data, sizeof(block->data), item_path);
+    download_put_block();
+    item_open = 1;
+}
+
+// passes file opened by download thread to write thread
+static void open_file(void)
+{
+    DownloadBlock* block = download_get_block();
+    block->type = BlockOpen;
+    block->file = item_file;
+    pkgi_strncpy((char*)block->data, sizeof(block->data), item_path);
+    download_put_block();
+    item_open = 1;
+}
+
+static void download_close_file(void)
+{
+    if (item_open)
+    {
+        DownloadBlock* block = download_get_block();
+        block->type = BlockClose;
+        download_put_block();
+        item_open = 0;
+    }
+    item_file = NULL;
+}
+
+static void pipeline_destroy(void)
+{
+    pkgi_meta_stop();
+    aes128_ctr_parallel_stop();
+
+    pkgi_free(write_buffer);
+    write_buffer = NULL;
+
+    pkgi_ring_destroy(&ring_free);
+    pkgi_ring_destroy(&ring_hash);
+    pkgi_ring_destroy(&ring_crypto);
+    pkgi_ring_destroy(&ring_write);
+    if (pipeline_sync)
+    {
+        pkgi_sema_destroy(pipeline_sync);
+        pipeline_sync = NULL;
+    }
+}
+
+static int pipeline_start(uint32_t buffer_size)
+{
+    write_failed = 0;
+    write_pending = 0;
+    write_file = NULL;
+    download_block = NULL;
+    chunk_valid = 0;
+    pkgi_keystream_init(&keystream, &aes, iv);
+    hash_bytes = 0;
+    hash_blocks = 0;
+    hash_msec = 0;
+    hash_lag_msec = 0;
+    hash_lag_max_msec = 0;
+    crypto_decrypt_msec = 0;
+
+    write_buffer_size = buffer_size;
+    write_buffer = pkgi_malloc(buffer_size);
+    if (!write_buffer)
+    {
+        LOG("cannot allocate %u bytes for write buffer", buffer_size);
+        return 0;
+    }
+
+    pipeline_sync = pkgi_sema_create("download_sync", 0, 1);
+    if (!pipeline_sync ||
+        !pkgi_ring_init(&ring_free, "download_free", DOWNLOAD_BLOCK_COUNT) ||
+        !pkgi_ring_init(&ring_hash, "download_hash", DOWNLOAD_BLOCK_COUNT) ||
+        !pkgi_ring_init(&ring_crypto, "download_crypto", DOWNLOAD_BLOCK_COUNT) ||
+        !pkgi_ring_init(&ring_write, "download_write", DOWNLOAD_BLOCK_COUNT))
+    {
+        pipeline_destroy();
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < DOWNLOAD_BLOCK_COUNT; i++)
+    {
+        pkgi_ring_push(&ring_free, blocks + i);
+    }
+
+    // without helper threads everything is decrypted by crypto thread
+    aes128_ctr_parallel_start(DOWNLOAD_AES_THREADS);
+
+    if (!pkgi_meta_start() || !pkgi_start_thread("download_write", &download_write_thread))
+    {
+        pipeline_destroy();
+        return 0;
+    }
+
+    if (!pkgi_start_thread("download_crypto", &download_crypto_thread))
+    {
+        // crypto thread is not running, so stop write thread directly
+        DownloadBlock* block = pkgi_ring_pop(&ring_free);
+        block->type = BlockQuit;
+        pkgi_ring_push(&ring_write, block);
+        pkgi_sema_wait(pipeline_sync);
+        pipeline_destroy();
+        return 0;
+    }
+
+    if (!pkgi_start_thread("download_hash", &download_hash_thread))
+    {
+        // hash thread is not running, so stop crypto thread directly
+        DownloadBlock* block = pkgi_ring_pop(&ring_free);
+        block->type = BlockQuit;
+        pkgi_ring_push(&ring_crypto, block);
+        pkgi_sema_wait(pipeline_sync);
+        pipeline_destroy();
+        return 0;
+    }
+
+    return 1;
+}
+
+static void pipeline_stop(void)
+{
+    DownloadBlock* block = download_get_block();
+    block->type = BlockQuit;
+    download_put_block();
+    pkgi_sema_wait(pipeline_sync);
+
+    LOG("%u checkpoints written in %u ms", checkpoint_count, checkpoint_msec);
+    LOG("pipeline stalls: download %u (%u ms), hash %u (%u ms), crypto %u (%u ms), write %u (%u ms)",
+        ring_free.pop_stalls, ring_free.pop_stall_msec,
+        ring_hash.pop_stalls + ring_crypto.push_stalls, ring_hash.pop_stall_msec + ring_crypto.push_stall_msec,
+        ring_crypto.pop_stalls + ring_write.push_stalls, ring_crypto.pop_stall_msec + ring_write.push_stall_msec,
+        ring_write.pop_stalls, ring_write.pop_stall_msec);
+    LOG("hash: %llu bytes in %u ms, lag avg %u ms, max %u ms, waited %u times (%u ms) for crypto thread",
+        hash_bytes, hash_msec, hash_blocks ? hash_lag_msec / hash_blocks : 0, hash_lag_max_msec,
+        ring_crypto.push_stalls, ring_crypto.push_stall_msec);
+    LOG("keystream: %llu bytes prefetched, %llu bytes computed inline", keystream.prefetched, keystream.computed);
+    LOG("crypto: %llu bytes decrypted in %u ms + %u ms generating keystream",
+        keystream.prefetched + keystream.computed, crypto_decrypt_msec, keystream.generate_msec);
+
+    pipeline_destroy();
+}
+
+static void download_start(void)
+{
+    LOG("resuming pkg download from %llu offset", download_offset);
+    download_resume = 0;
+    info_update = pkgi_time_msec() + 1000;
+    pkgi_dialog_set_progress_title("Downloading");
+}
+
+static int download_data(uint8_t* buffer, uint32_t size, int encrypted, int save)
+{
+    if (pkgi_dialog_is_cancelled())
+    {
+        download_save_resume();
+        return 0;
+    }
+
+    if (write_failed)
+    {
+        // reports error after write thread is finished
+        download_sync();
+        return -1;
+    }
+
+    update_progress();
+
+    if (download_resume)
+    {
+        if (download_offset < resume.offset)
+        {
+            // this is only for non-encrypted files (head/tail) when resuming
+            DownloadBlock* block = download_get_block();
+            size = (uint32_t)min64(min32(size, sizeof(block->data)), resume.offset - download_offset);
+
+            int read = pkgi_read(item_file, block->data, size);
+            if (read < 0)
+            {
+                char error[256];
+                pkgi_snprintf(error, sizeof(error), "failed to read file %s", item_path);
+                pkgi_dialog_error(error);
+                return -1;
+            }
+            else if (read == 0)
+            {
+                resume_failed();
+                return -1;
+            }
+
+            if (buffer)
+            {
+                pkgi_memcpy(buffer, block->data, read);
+            }
+            download_offset += read;
+            return read;
+        }
+
+        // everything from resume file is read, need to start actual download
+        download_start();
+    }
+    else if (download_offset != checkpoint_offset)
+    {
+        if (download_offset - checkpoint_offset >= RESUME_CHECKPOINT_SIZE || pkgi_time_msec() - checkpoint_time >= RESUME_CHECKPOINT_TIME)
+        {
+            download_checkpoint();
+        }
+    }
+
+    if (download_ranged && download_offset == download_range_end)
+    {
+        // tail.bin is downloaded with single connection
+        pkgi_range_stop();
+        download_ranged = 0;
+    }
+
+    if (!http && !download_ranged && !download_reading)
+    {
+        initial_offset = download_offset;
+
+        int64_t http_length;
+        if (local_file[0])
+        {
+            http_length = pkgi_reader_start(local_file, download_offset);
+            if (http_length < 0)
+            {
+                char error[256];
+                pkgi_snprintf(error, sizeof(error), "failed to read file %s", local_file);
+                pkgi_dialog_error(error);
+                return 0;
+            }
+            download_reading = 1;
+        }
+        else if (download_connections > 1 && download_offset < download_range_end)
+        {
+            // pkg size is known from its header, so ranged download starts without request for rest of pkg
+            http_length = total_size - download_offset;
+        }
+        else
+        {
+            LOG("requesting %s @ %llu", download_url, download_offset);
+            http = pkgi_http_get(download_url, download_content, download_offset);
+            if (!http)
+            {
+                pkgi_dialog_error("cannot send HTTP request");
+                return 0;
+            }
+
+            if (!pkgi_http_response_length(http, &http_length))
+            {
+                pkgi_dialog_error("HTTP request failed");
+                return 0;
+            }
+            if (http_length < 0)
+            {
+                pkgi_dialog_error("HTTP response has unknown length");
+                return 0;
+            }
+        }
+
+        download_size = http_length + download_offset;
+
+        if (!pkgi_check_free_space(http_length))
+        {
+            return 0;
+        }
+
+        LOG("http response length = %lld, total pkg size = %llu", http_length, download_size);
+        info_start = pkgi_time_msec();
+        info_update = pkgi_time_msec() + 500;
+
+        if (!http && !download_reading)
+        {
+            if (!pkgi_range_start(download_url, download_offset, download_range_end, download_connections))
+            {
+                pkgi_dialog_error("cannot start download threads");
+                return 0;
+            }
+            download_ranged = 1;
+        }
+    }
+
+    DownloadBlock* block = download_get_block();
+    size = min32(size, sizeof(block->data));
+
+    int read;
+    if (download_ranged)
+    {
+        read = pkgi_range_read(block->data, size);
+    }
+    else if (download_reading)
+    {
+        read = pkgi_reader_read(block->data, size);
+        if (read <= 0)
+        {
+            char error[256];
+            pkgi_snprintf(error, sizeof(error), "failed to read file %s", local_file);
+            pkgi_dialog_error(error);
+            download_save_resume();
+            return -1;
+        }
+    }
+    else
+    {
+        read = pkgi_http_read(http, block->data, size);
+    }
+
+    if (read < 0)
+    {
+        char error[256];
+        pkgi_snprintf(error, sizeof(error), "HTTP download error 0x%08x", read);
+        pkgi_dialog_error(error);
+        download_save_resume();
+        return -1;
+    }
+    else if (read == 0)
+    {
+        pkgi_dialog_error("HTTP connection closed");
+        download_save_resume();
+        return -1;
+    }
+    block->offset = download_offset;
+    block->item_index = item_index;
+    download_offset += read;
+
+    if (buffer)
+    {
+        pkgi_memcpy(buffer, block->data, read);
+    }
+
+    block->type = BlockData;
+    block->size = read;
+    block->encrypted = encrypted;
+    block->encrypted_offset = encrypted_base + encrypted_offset;
+    block->item_offset = encrypted_offset;
+
+    if (encrypted)
+    {
+        encrypted_offset += read;
+    }
+
+    if (save)
+    {
+        if (encrypted)
+        {
+            block->write = (uint32_t)min64(decrypted_size, read);
+            decrypted_size -= block->write;
+        }
+        else
+        {
+            block->write = read;
+        }
+    }
+    else
+    {
+        block->write = 0;
+    }
+
+    download_put_block();
+
+    return read;
+}
+
+// reads next bytes of head.bin
+static int head_read(uint8_t* buffer, uint32_t size)
+{
+    while (size != 0)
+    {
+        int read = download_data(buffer, size, 0, 1);
+        if (read <= 0)
+        {
+            return 0;
+        }
+        buffer += read;
+        size -= read;
+    }
+    return 1;
+}
+
+// downloads head.bin up to offset, only writing it to file
+static int head_skip(uint64_t offset)
+{
+    while (download_offset < offset)
+    {
+        uint32_t size = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, offset - download_offset);
+        if (download_data(NULL, size, 0, 1) <= 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int download_head(const uint8_t* rif)
+{
+    LOG("downloading pkg head");
+
+    pkgi_strncpy(item_name, sizeof(item_name), "Preparing...");
+    pkgi_snprintf(item_path, sizeof(item_path), "%s/sce_sys/package/head.bin", root);
+
+    int result = 0;
+    uint8_t* names = NULL;
+
+    if (download_resume)
+    {
+        item_file = pkgi_openrw(item_path);
+        if (item_file)
+        {
+            LOG("trying to resume %s file", item_name);
+            open_file();
+        }
+        else
+        {
+            // nothing can be resumed without head.bin, sha256 is restarted before any data is hashed
+            LOG("%s is missing, starting download from scratch", item_path);
+            pkgi_rm(resume_file);
+            sha256_init(&sha);
+            resume.offset = 0;
+            checkpoint_offset = 0;
+            download_start();
+        }
+    }
+
+    if (!download_resume)
+    {
+        create_file(1, 0, 0);
+    }
+
+    uint8_t header[PKG_HEADER_SIZE + PKG_HEADER_EXT_SIZE];
+    if (!head_read(header, sizeof(header)))
+    {
+        goto bail;
+    }
+
+    if (get32be(header) != 0x7f504b47 || get32be(header + PKG_HEADER_SIZE) != 0x7F657874)
+    {
+        pkgi_dialog_error("wrong pkg header");
+        goto bail;
+    }
+
+    if (rif && !pkgi_memequ(rif + 0x10, header + 0x30, 0x30))
+    {
+        pkgi_dialog_error("zRIF content id doesn't match pkg");
+        goto bail;
+    }
+
+    meta_offset = get32be(header + 8);
+    meta_count = get32be(header + 12);
+    index_count = get32be(header + 20);
+    total_size = get64be(header + 24);
+    enc_offset = get64be(header + 32);
+    enc_size = get64be(header + 40);
+    LOG("meta_offset=%u meta_count=%u index_count=%u total_size=%llu enc_offset=%llu enc_size=%llu",
+        meta_offset, meta_count, index_count, total_size, enc_offset, enc_size);
+
+    if (meta_offset < sizeof(header) || meta_offset > enc_offset || enc_offset + enc_size > total_size)
+    {
+        pkgi_dialog_error("pkg file is too small or corrupted");
+        goto bail;
+    }
+
+    pkgi_memcpy(iv, header + 0x70, sizeof(iv));
+
+    uint8_t key[AES_BLOCK_SIZE];
+    int key_type = header[0xe7] & 7;
+    if (key_type == 1)
+    {
+        pkgi_memcpy(key, pkg_psp_key, sizeof(key));
+    }
+    else if (key_type == 2)
+    {
+        aes128_ctx ctx;
+        aes128_init(&ctx, pkg_vita_2);
+        aes128_encrypt(&ctx, iv, key);
+    }
+    else if (key_type == 3)
+    {
+        aes128_ctx ctx;
+        aes128_init(&ctx, pkg_vita_3);
+        aes128_encrypt(&ctx, iv, key);
+    }
+    else if (key_type == 4)
+    {
+        aes128_ctx ctx;
+        aes128_init(&ctx, pkg_vita_4);
+        aes128_encrypt(&ctx, iv, key);
+    }
+
+    aes128_ctr_init(&aes, key);
+
+    if (!head_skip(meta_offset))
+    {
+        goto bail;
+    }
+
+    // only beginning of metadata entries is needed, rest is skipped
+    index_size = 0;
+    uint32_t index_offset = 1;
+    for (uint32_t i = 0; i < meta_count; i++)
+    {
+        uint8_t meta[8 + 16];
+        if (download_offset + 8 > enc_offset || !head_read(meta, 8))
+        {
+            pkgi_dialog_error("pkg file is too small or corrupted");
+            goto bail;
+        }
+
+        uint32_t type = get32be(meta + 0);
+        uint32_t size = get32be(meta + 4);
+        if (download_offset + size > enc_offset)
+        {
+            pkgi_dialog_error("pkg file is too small or corrupted");
+            goto bail;
+        }
+
+        uint32_t read = min32(size, sizeof(meta) - 8);
+        if (!head_read(meta + 8, read))
+        {
+            goto bail;
+        }
+
+        if (type == 2 && read >= 4)
+        {
+            uint32_t content_type = get32be(meta + 8);
+            if (content_type != 21)
+            {
+                pkgi_dialog_error("pkg is not a main package");
+                goto bail;
+            }
+        }
+        else if (type == 13 && read >= 8)
+        {
+            index_offset = get32be(meta + 8);
+            index_size = get32be(meta + 12);
+        }
+
+        if (!head_skip(download_offset + size - read))
+        {
+            goto bail;
+        }
+    }
+
+    if (index_offset != 0 || index_size == 0 || index_count > index_size / 32 || enc_offset + index_size > total_size)
+    {
+        pkgi_dialog_error("pkg is missing encrypted file index");
+        goto bail;
+    }
+
+    if (!head_skip(enc_offset))
+    {
+        goto bail;
+    }
+
+    uint32_t names_offset = index_count * 32;
+    uint32_t names_size = index_size - names_offset;
+    index_items = pkgi_malloc(max32(index_count, 1) * sizeof(*index_items));
+    names = pkgi_malloc(max32(names_size, 1));
+    if (!index_items || !names)
+    {
+        pkgi_dialog_error("not enough memory to download pkg");
+        goto bail;
+    }
+
+    // index entries are decrypted in batches, so aes128_ctr can use its parallel path
+    uint64_t interned_size = 0;
+    uint32_t index = 0;
+    while (index != index_count)
+    {
+        uint8_t items[64 * 32] GCC_ALIGN(16);
+        uint32_t count = min32(index_count - index, sizeof(items) / 32);
+        if (!head_read(items, count * 32))
+        {
+            goto bail;
+        }
+        aes128_ctr(&aes, iv, 32 * index, items, count * 32);
+
+        for (uint32_t i = 0; i < count; i++, index++)
+        {
+            const uint8_t* item = items + 32 * i;
+
+            IndexItem* parsed = index_items + index;
+            parsed->name = get32be(item + 0);
+            uint32_t name_size = get32be(item + 4);
+            parsed->offset = get64be(item + 8);
+            parsed->size = get64be(item + 16);
+            parsed->type = item[27];
+
+            if (name_size > sizeof(item_name) - 1 || parsed->name < names_offset
+                || parsed->name > index_size || name_size > index_size - parsed->name)
+            {
+                pkgi_dialog_error("pkg file is too small or corrupted");
+                goto bail;
+            }
+            parsed->name_size = (uint16_t)name_size;
+            interned_size += name_size + 1;
+        }
+    }
+
+    if (!head_read(names, names_size))
+    {
+        goto bail;
+    }
+    aes128_ctr(&aes, iv, names_offset, names, names_size);
+
+    // every name gets its own zero terminated copy, so it can be used directly as string
+    index_names = interned_size <= 0xffffffff ? pkgi_malloc((uint32_t)max64(interned_size, 1)) : NULL;
+    if (!index_names)
+    {
+        pkgi_dialog_error("not enough memory to download pkg");
+        goto bail;
+    }
+
+    uint32_t interned = 0;
+    for (index = 0; index < index_count; index++)
+    {
+        IndexItem* item = index_items + index;
+        pkgi_memcpy(index_names + interned, names + item->name - names_offset, item->name_size);
+        index_names[interned + item->name_size] = 0;
+        item->name = interned;
+        interned += item->name_size + 1;
+    }
+
+    LOG("head.bin downloaded");
+    result = 1;
+
+bail:
+    download_close_file();
+    pkgi_free(names);
+
+    return result;
+}
+
+static uint32_t folder_hash(const char* name, uint32_t length)
+{
+    // FNV-1a
+    uint32_t hash = 0x811c9dc5;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+// folder that must exist for item - whole name for folders, parent folder for files
+static uint32_t folder_length(const IndexItem* item)
+{
+    uint32_t length = item->name_size;
+    if (item->type != 4 && item->type != 18)
+    {
+        const char* name = index_names + item->name;
+        while (length != 0 && name[length - 1] != '/')
+        {
+            length--;
+        }
+        if (length != 0)
+        {
+            length--;
+        }
+    }
+    return length;
+}
+
+// with preallocation files take their full size when they are created, so whole tree must fit
+// before anything is written, otherwise download could fail only when it is almost finished
+static int check_tree_space(void)
+{
+    // head.bin and tail.bin are whole pkg except encrypted files
+    uint64_t tree_size = total_size - enc_size;
+    for (uint32_t index = 0; index < index_count; index++)
+    {
+        const IndexItem* item = index_items + index;
+        if (item->type != 4 && item->type != 18)
+        {
+            tree_size += item->size;
+        }
+    }
+    LOG("installed files need %llu bytes", tree_size);
+
+    return pkgi_check_free_space(tree_size);
+}
+
+// creates all folders from pkg index before downloading files, each folder only once
+static int create_folders(void)
+{
+    LOG("creating folders");
+
+    int result = 0;
+    uint32_t* folders = NULL;
+
+    uint32_t max_folders = 0;
+    for (uint32_t index = 0; index < index_count; index++)
+    {
+        const IndexItem* item = index_items + index;
+        const char* name = index_names + item->name;
+
+        uint32_t length = folder_length(item);
+        if (length == 0)
+        {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < length; i++)
+        {
+            max_folders += name[i] == '/';
+        }
+        max_folders++;
+    }
+
+    // hash set of created folders, stores offset+1 of folder name in index_names
+    uint32_t folders_size = 16;
+    while (folders_size < 2 * max_folders)
+    {
+        folders_size *= 2;
+    }
+
+    folders = pkgi_malloc(folders_size * sizeof(*folders));
+    if (!folders)
+    {
+        pkgi_dialog_error("not enough memory to create folders");
+        goto bail;
+    }
+    for (uint32_t i = 0; i < folders_size; i++)
+    {
+        folders[i] = 0;
+    }
+
+    uint32_t created = 0;
+    for (uint32_t index = 0; index < index_count; index++)
+    {
+        const IndexItem* item = index_items + index;
+        const char* name = index_names + item->name;
+
+        uint32_t folder = folder_length(item);
+        if (folder == 0)
+        {
+            continue;
+        }
+
+        // go over all parent folders first, so they are created in depth order
+        for (uint32_t length = 1; length <= folder; length++)
+        {
+            if (length != folder && name[length] != '/')
+            {
+                continue;
+            }
+
+            uint32_t slot = folder_hash(name, length) & (folders_size - 1);
+            for (;;)
+            {
+                if (folders[slot] == 0)
+                {
+                    folders[slot] = item->name + 1;
+
+                    DownloadBlock* block = download_get_block();
+                    block->type = BlockFolder;
+                    pkgi_snprintf((char*)block->data, sizeof(block->data), "%s/%.*s", root, length, name);
+                    pkgi_meta_mkdir((const char*)block->data);
+                    download_put_block();
+                    created++;
+                    break;
+                }
+
+                const char* other = index_names + folders[slot] - 1;
+                if (pkgi_memequ(other, name, length) && (other[length] == '/' || other[length] == 0))
+                {
+                    break;
+                }
+                slot = (slot + 1) & (folders_size - 1);
+            }
+        }
+    }
+
+    LOG("%u folders created", created);
+    result = 1;
+
+bail:
+    pkgi_free(folders);
+    return result;
+}
+
+// closes current connection or local file
+static void download_disconnect(void)
+{
+    if (download_ranged)
+    {
+        pkgi_range_stop();
+        download_ranged = 0;
+    }
+    if (download_reading)
+    {
+        pkgi_reader_stop();
+        download_reading = 0;
+    }
+    if (http)
+    {
+        pkgi_http_close(http);
+        http = NULL;
+    }
+}
+
+// closes current connection, so next download_data requests data from new offset
+static void download_skip(uint64_t offset)
+{
+    LOG("skipping %llu bytes", offset - download_offset);
+    download_disconnect();
+    download_offset = offset;
+}
+
+// files are downloaded in order of their offset in pkg, plan has their indices in that order
+static int plan_lower(uint32_t a, uint32_t b)
+{
+    const IndexItem* x = index_items + a;
+    const IndexItem* y = index_items + b;
+    return x->offset < y->offset || (x->offset == y->offset && a < b);
+}
+
+static void plan_heapify(uint32_t* plan, uint32_t n, uint32_t index)
+{
+    uint32_t largest = index;
+    uint32_t left = 2 * index + 1;
+    uint32_t right = 2 * index + 2;
+
+    if (left < n && plan_lower(plan[largest], plan[left]))
+    {
+        largest = left;
+    }
+
+    if (right < n && plan_lower(plan[largest], plan[right]))
+    {
+        largest = right;
+    }
+
+    if (largest != index)
+    {
+        uint32_t temp = plan[index];
+        plan[index] = plan[largest];
+        plan[largest] = temp;
+        plan_heapify(plan, n, largest);
+    }
+}
+
+static uint32_t* create_plan(uint32_t* count)
+{
+    uint32_t* plan = pkgi_malloc(max32(index_count, 1) * sizeof(*plan));
+    if (!plan)
+    {
+        return NULL;
+    }
+
+    uint32_t plan_count = 0;
+    for (uint32_t index = 0; index < index_count; index++)
+    {
+        uint8_t type = index_items[index].type;
+        if (type != 4 && type != 18)
+        {
+            plan[plan_count++] = index;
+        }
+    }
+
+    for (int i = plan_count / 2 - 1; i >= 0; i--)
+    {
+        plan_heapify(plan, plan_count, i);
+    }
+
+    for (int i = plan_count - 1; i > 0; i--)
+    {
+        uint32_t temp = plan[i];
+        plan[i] = plan[0];
+        plan[0] = temp;
+        plan_heapify(plan, i, 0);
+    }
+
+    *count = plan_count;
+    return plan;
+}
+
+// end of files that are downloaded with one request, stops before unused data that will be skipped
+static uint64_t plan_run_end(const uint32_t* plan, uint32_t position, uint32_t count)
+{
+    uint64_t end = 0;
+    for (; position < count; position++)
+    {
+        const IndexItem* item = index_items + plan[position];
+        if (item->size == 0)
+        {
+            continue;
+        }
+
+        uint64_t start = enc_offset + item->offset;
+        if (end != 0 && start >= end + DOWNLOAD_SKIP_SIZE)
+        {
+            break;
+        }
+        end = max64(end, start + ((item->size + AES_BLOCK_SIZE - 1) & ~((uint64_t)AES_BLOCK_SIZE - 1)));
+    }
+    return end;
+}
+
+static int download_files(void)
+{
+    LOG("downloading encrypted files");
+
+    int result = 0;
+
+    if (http && download_connections > 1 && !pkgi_http_is_local(http))
+    {
+        // reconnect with multiple connections for encrypted files
+        pkgi_http_close(http);
+        http = NULL;
+    }
+
+    uint32_t plan_count;
+    uint32_t* plan = create_plan(&plan_count);
+    if (!plan)
+    {
+        pkgi_dialog_error("not enough memory to download files");
+        return 0;
+    }
+
+    download_range_end = enc_offset + enc_size;
+
+    // files before checkpoint item in plan are complete
+    uint32_t resume_position = plan_count;
+    if (download_resume && resume.item_index >= 0)
+    {
+        for (resume_position = 0; resume_position < plan_count; resume_position++)
+        {
+            if ((int32_t)plan[resume_position] == resume.item_index)
+            {
+                break;
+            }
+        }
+        if (resume_position == plan_count)
+        {
+            resume_failed();
+            goto bail;
+        }
+    }
+
+    // files after checkpoint item are always created from scratch, so metadata worker creates them ahead
+    uint32_t ahead_start = download_resume ? min32(resume_position + 1, plan_count) : 0;
+    uint32_t ahead_end = ahead_start; // files before it are queued in pkgi_meta
+
+    for (uint32_t position = 0; position < plan_count; position++)
+    {
+        uint32_t index = plan[position];
+        const IndexItem* item = index_items + index;
+        uint64_t item_offset = item->offset;
+        uint64_t item_size = item->size;
+
+        pkgi_strncpy(item_name, sizeof(item_name), index_names + item->name);
+
+        LOG("[%u/%u] %s item_offset=%llu item_size=%llu type=%u", index + 1, index_count, item_name, item_offset, item_size, item->type);
+
+        pkgi_snprintf(item_path, sizeof(item_path), "%s/%s", root, item_name);
+
+        uint64_t item_start = enc_offset + item_offset;
+        uint64_t encrypted_size = (item_size + AES_BLOCK_SIZE - 1) & ~((uint64_t)AES_BLOCK_SIZE - 1);
+        decrypted_size = item_size;
+        encrypted_base = item_offset;
+        encrypted_offset = 0;
+        item_index = index;
+
+        if (download_resume)
+        {
+            if (pkgi_dialog_is_cancelled())
+            {
+                goto bail;
+            }
 
-            int64_t current_size = pkgi_get_size(item_path);
-            if (current_size < 0)
+            if (position < resume_position)
             {
-                LOG("file does not exist %s", item_path);
-                download_start();
+                LOG("file fully downloaded %s", item_name);
+                if (encrypted_size != 0)
+                {
+                    download_offset = item_start + encrypted_size;
+                }
+                update_progress();
+                continue;
             }
-            else if ((uint64_t)current_size != decrypted_size)
+
+            if (resume.offset < item_start)
             {
-                LOG("downloaded %llu, total %llu, resuming %s", (uint64_t)current_size, decrypted_size, item_path);
-                item_file = pkgi_append(item_path);
-                if (!item_file)
+                // checkpoint is in unused data before this file
+                if (resume.offset < download_offset)
                 {
-                    char error[256];
-                    pkgi_snprintf(error, sizeof(error), "cannot append to %s", item_name);
-                    pkgi_dialog_error(error);
+                    resume_failed();
                     goto bail;
                 }
-                encrypted_offset = (uint64_t)current_size;
-                decrypted_size -= current_size;
-                download_offset += current_size;
+                download_offset = resume.offset;
                 download_start();
             }
             else
             {
-                LOG("file fully downloaded %s", item_name);
-                download_offset += encrypted_size;
-                update_progress();
-                continue;
+                uint64_t written = min64(resume.item_offset, item_size);
+                LOG("downloaded %llu, total %llu, resuming %s", written, item_size, item_path);
+
+                item_file = pkgi_openrw(item_path);
+                if (!item_file || !pkgi_seek(item_file, written) || item_start + resume.item_offset != resume.offset)
+                {
+                    if (item_file)
+                    {
+                        pkgi_close(item_file);
+                        item_file = NULL;
+                    }
+                    resume_failed();
+                    goto bail;
+                }
+                open_file();
+                encrypted_offset = resume.item_offset;
+                decrypted_size -= written;
+                download_offset = resume.offset;
+                download_start();
+            }
+        }
+
+        // empty files have no data, so their offset does not matter
+        if ((encrypted_size != 0 && item_start + encrypted_offset < download_offset) || item_start + item_size > total_size)
+        {
+            pkgi_dialog_error("pkg file is too small or corrupted");
+            goto bail;
+        }
+
+        if (encrypted_size != 0 && download_offset < item_start)
+        {
+            // data between files is not used by any file, it is needed only for sha256
+            if (download_skip_unused && item_start - download_offset >= DOWNLOAD_SKIP_SIZE)
+            {
+                download_skip(item_start);
+            }
+        }
+
+        if (download_skip_unused && !http && !download_ranged)
+        {
+            // next request downloads files only up to unused data that will be skipped
+            download_range_end = plan_run_end(plan, position, plan_count);
+        }
+
+        if (encrypted_size != 0 && download_offset < item_start)
+        {
+            while (download_offset < item_start)
+            {
+                uint32_t read = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, item_start - download_offset);
+                int size = download_data(NULL, read, 0, 0);
+                if (size <= 0)
+                {
+                    goto bail;
+                }
             }
         }
 
         // if we are starting to download file from scratch
-        if (!download_resume && !item_file)
+        if (!item_open)
+        {
+            int ahead = position >= ahead_start;
+            for (; ahead && ahead_end < plan_count && ahead_end <= position + DOWNLOAD_CREATE_AHEAD; ahead_end++)
+            {
+                const IndexItem* next = index_items + plan[ahead_end];
+                char path[256];
+                pkgi_snprintf(path, sizeof(path), "%s/%s", root, index_names + next->name);
+                pkgi_meta_create(path, download_preallocate ? next->size : 0);
+            }
+
+            // all folders are already created by create_folders
+            create_file(0, item_size, ahead);
+        }
+
+        while (encrypted_offset != encrypted_size)
+        {
+            uint32_t read = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, encrypted_size - encrypted_offset);
+            int size = download_data(NULL, read, 1, 1);
+            if (size <= 0)
+            {
+                goto bail;
+            }
+        }
+
+        download_close_file();
+    }
+
+    item_index = -1;
+
+    LOG("all files decrypted");
+    result = 1;
+
+bail:
+    download_close_file();
+    pkgi_free(plan);
+    return result;
+}
+
+static void extract_fail(const char* msg, const char* path)
+{
+    pkgi_sema_wait(extract_lock);
+    if (!extract_failed)
+    {
+        pkgi_snprintf(extract_error, sizeof(extract_error), "%s %s", msg, path);
+        LOG("%s", extract_error);
+        extract_failed = 1;
+    }
+    extract_abort = 1;
+    pkgi_sema_signal(extract_lock);
+}
+
+static void extract_job(const ExtractJob* job, void* pkg, uint8_t* buffer)
+{
+    const IndexItem* item = index_items + job->index;
+
+    char path[256];
+    pkgi_snprintf(path, sizeof(path), "%s/%s", root, index_names + item->name);
+
+    // files split in multiple jobs are created before threads start
+    int whole = job->start == 0 && job->end == item->size;
+    void* f = whole ? pkgi_create(path) : pkgi_openrw(path);
+    if (!f || (!whole && !pkgi_seek(f, job->start)))
+    {
+        extract_fail(whole ? "cannot create file" : "cannot open file", path);
+        goto bail;
+    }
+    if (whole && download_preallocate && item->size != 0 && !pkgi_preallocate(f, item->size))
+    {
+        extract_fail("not enough free space for", path);
+        goto bail;
+    }
+
+    if (!pkgi_seek(pkg, enc_offset + item->offset + job->start))
+    {
+        extract_fail("failed to read file", local_file);
+        goto bail;
+    }
+
+    uint64_t offset = job->start;
+    while (offset != job->end && !extract_abort)
+    {
+        uint32_t size = (uint32_t)min64(EXTRACT_BUFFER_SIZE, job->end - offset);
+        uint32_t received = 0;
+        while (received != size)
+        {
+            int read = pkgi_read(pkg, buffer + received, size - received);
+            if (read <= 0)
+            {
+                extract_fail("failed to read file", local_file);
+                goto bail;
+            }
+            received += read;
+        }
+
+        aes128_ctr(&aes, iv, item->offset + offset, buffer, size);
+
+        if (!pkgi_write(f, buffer, size))
+        {
+            extract_fail("cannot write to", path);
+            goto bail;
+        }
+        offset += size;
+
+        pkgi_sema_wait(extract_lock);
+        extract_written += size;
+        pkgi_sema_signal(extract_lock);
+    }
+
+bail:
+    if (f)
+    {
+        pkgi_close(f);
+    }
+}
+
+static void extract_thread(void)
+{
+    uint8_t* buffer = pkgi_malloc(EXTRACT_BUFFER_SIZE);
+    void* pkg = pkgi_open(local_file);
+    if (!buffer || !pkg)
+    {
+        extract_fail("cannot read", local_file);
+    }
+
+    for (;;)
+    {
+        pkgi_sema_wait(extract_lock);
+        uint32_t job = extract_next;
+        int finished = extract_abort || job == extract_job_count;
+        if (!finished)
+        {
+            extract_next++;
+        }
+        pkgi_sema_signal(extract_lock);
+
+        if (finished)
+        {
+            break;
+        }
+        extract_job(extract_jobs + job, pkg, buffer);
+    }
+
+    if (pkg)
+    {
+        pkgi_close(pkg);
+    }
+    pkgi_free(buffer);
+    pkgi_sema_signal(extract_done);
+}
+
+static void extract_destroy(void)
+{
+    pkgi_free(extract_jobs);
+    extract_jobs = NULL;
+
+    if (extract_done)
+    {
+        pkgi_sema_destroy(extract_done);
+        extract_done = NULL;
+    }
+    if (extract_lock)
+    {
+        pkgi_sema_destroy(extract_lock);
+        extract_lock = NULL;
+    }
+}
+
+// splits files from plan in jobs, big files are created here so their parts can be written in any order
+static int create_jobs(const uint32_t* plan, uint32_t plan_count)
+{
+    extract_job_count = 0;
+    for (uint32_t position = 0; position < plan_count; position++)
+    {
+        const IndexItem* item = index_items + plan[position];
+        if (enc_offset + item->offset + item->size > total_size)
+        {
+            pkgi_dialog_error("pkg file is too small or corrupted");
+            return 0;
+        }
+        extract_job_count += (uint32_t)max64((item->size + EXTRACT_RANGE_SIZE - 1) / EXTRACT_RANGE_SIZE, 1);
+    }
+
+    extract_jobs = pkgi_malloc(max32(extract_job_count, 1) * sizeof(*extract_jobs));
+    if (!extract_jobs)
+    {
+        pkgi_dialog_error("not enough memory to extract files");
+        return 0;
+    }
+
+    ExtractJob* job = extract_jobs;
+    for (uint32_t position = 0; position < plan_count; position++)
+    {
+        const IndexItem* item = index_items + plan[position];
+        if (item->size > EXTRACT_RANGE_SIZE)
         {
-            if (!create_file())
+            pkgi_snprintf(item_path, sizeof(item_path), "%s/%s", root, index_names + item->name);
+            void* f = pkgi_create(item_path);
+            int reserved = f && (!download_preallocate || pkgi_preallocate(f, item->size));
+            if (f)
+            {
+                pkgi_close(f);
+            }
+            if (!reserved)
             {
                 char error[256];
-                pkgi_snprintf(error, sizeof(error), "cannot create %s", item_name);
+                pkgi_snprintf(error, sizeof(error), "%s %s", f ? "not enough free space for" : "cannot create file", item_path);
                 pkgi_dialog_error(error);
+                return 0;
+            }
+        }
+
+        uint64_t start = 0;
+        do
+        {
+            job->index = plan[position];
+            job->start = start;
+            job->end = min64(start + EXTRACT_RANGE_SIZE, item->size);
+            start = job->end;
+            job++;
+        }
+        while (start != item->size);
+    }
+
+    return 1;
+}
+
+// local pkg can be read at any offset, so files are extracted by multiple threads, while
+// this thread reads whole pkg sequentially for sha256
+static int extract_files(void)
+{
+    LOG("extracting encrypted files from %s", local_file);
+
+    pkgi_strncpy(item_name, sizeof(item_name), "Extracting...");
+    item_index = -1;
+
+    // head.bin & folders must be written, and sha256 is not updated by hash thread after this
+    if (!download_sync())
+    {
+        return 0;
+    }
+    download_disconnect();
+
+    int result = 0;
+    uint32_t started = 0;
+    uint32_t finished = 0;
+    int hashing = 0;
+
+    uint32_t plan_count;
+    uint32_t* plan = create_plan(&plan_count);
+    if (!plan)
+    {
+        pkgi_dialog_error("not enough memory to extract files");
+        return 0;
+    }
+
+    extract_next = 0;
+    extract_written = 0;
+    extract_abort = 0;
+    extract_failed = 0;
+
+    if (!create_jobs(plan, plan_count))
+    {
+        goto bail;
+    }
+
+    extract_lock = pkgi_sema_create("extract_lock", 1, 1);
+    extract_done = pkgi_sema_create("extract_done", 0, EXTRACT_THREAD_COUNT);
+    if (!extract_lock || !extract_done)
+    {
+        pkgi_dialog_error("cannot start extract threads");
+        goto bail;
+    }
+
+    for (uint32_t i = 0; i < EXTRACT_THREAD_COUNT; i++)
+    {
+        if (!pkgi_start_thread("extract_thread", &extract_thread))
+        {
+            break;
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        pkgi_dialog_error("cannot start extract threads");
+        goto bail;
+    }
+    LOG("extracting %u jobs with %u threads", extract_job_count, started);
+
+    // data not used by any file is needed only for sha256
+    uint64_t extract_offset = download_offset;
+    uint64_t hash_offset = download_offset;
+    uint64_t tail_offset = enc_offset + enc_size;
+    if (!download_skip_unused)
+    {
+        if (pkgi_reader_start(local_file, hash_offset) < 0)
+        {
+            extract_fail("failed to read file", local_file);
+        }
+        hashing = 1;
+    }
+
+    while (finished != started)
+    {
+        if (pkgi_dialog_is_cancelled())
+        {
+            extract_abort = 1;
+        }
+
+        if (hashing && hash_offset != tail_offset && !extract_abort)
+        {
+            // data is hashed directly from reader without copying it
+            const uint8_t* data;
+            uint32_t size = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, tail_offset - hash_offset);
+            int read = pkgi_reader_next(&data, size);
+            if (read <= 0)
+            {
+                extract_fail("failed to read file", local_file);
+                continue;
+            }
+            sha256_update(&sha, data, read);
+            hash_offset += read;
+        }
+        else if (pkgi_sema_poll(extract_done))
+        {
+            finished++;
+            continue;
+        }
+        else if (extract_abort)
+        {
+            pkgi_sema_wait(extract_done);
+            finished++;
+            continue;
+        }
+        else
+        {
+            pkgi_sleep(10);
+        }
+
+        pkgi_sema_wait(extract_lock);
+        uint64_t written = extract_written;
+        pkgi_sema_signal(extract_lock);
+
+        download_offset = extract_offset + written;
+        if (hashing)
+        {
+            download_offset = min64(download_offset, hash_offset);
+        }
+        update_progress();
+    }
+
+    if (extract_failed)
+    {
+        pkgi_dialog_error(extract_error);
+        goto bail;
+    }
+    if (extract_abort)
+    {
+        goto bail;
+    }
+
+    // tail.bin continues from end of files, chunks are not hashed while extracting
+    download_offset = tail_offset;
+    chunk_valid = 0;
+
+    LOG("all files extracted");
+    result = 1;
+
+bail:
+    if (hashing)
+    {
+        pkgi_reader_stop();
+    }
+    extract_destroy();
+    pkgi_free(plan);
+    return result;
+}
+
+static int download_tail(void)
+{
+    LOG("downloading tail.bin");
+
+    int result = 0;
+
+    pkgi_strncpy(item_name, sizeof(item_name), "Finishing...");
+    pkgi_snprintf(item_path, sizeof(item_path), "%s/sce_sys/package/tail.bin", root);
+
+    uint64_t tail_offset = enc_offset + enc_size;
+
+    if (download_resume && resume.offset > tail_offset)
+    {
+        // data between files and tail.bin is not saved, so continue after it
+        download_offset = tail_offset;
+
+        item_file = pkgi_openrw(item_path);
+        if (!item_file)
+        {
+            resume_failed();
+            goto bail;
+        }
+        open_file();
+    }
+    else
+    {
+        if (download_resume)
+        {
+            if (resume.offset < download_offset)
+            {
+                resume_failed();
                 goto bail;
             }
+            download_offset = resume.offset;
+            download_start();
         }
+        create_file(1, total_size - tail_offset, 0);
+    }
+
+    // data between files and tail.bin is needed only for sha256, so skip it when there is no digest
+    // and new request is cheaper than reading it (ranged download has to reconnect for tail.bin anyway)
+    if (download_skip_unused && download_offset < tail_offset && (download_ranged || tail_offset - download_offset >= DOWNLOAD_SKIP_SIZE))
+    {
+        download_skip(tail_offset);
+    }
 
-        if (enc_offset + item_offset + encrypted_offset != download_offset)
+    while (download_offset < tail_offset)
+    {
+        uint32_t read = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, tail_offset - download_offset);
+        int size = download_data(NULL, read, 0, 0);
+        if (size <= 0)
         {
-            pkgi_dialog_error("pkg is not supported, files are in wrong order");
             goto bail;
         }
+    }
 
-        if (enc_offset + item_offset + item_size > total_size)
+    while (download_offset != total_size)
+    {
+        uint32_t read = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, total_size - download_offset);
+        int size = download_data(NULL, read, 0, 1);
+        if (size <= 0)
         {
-            pkgi_dialog_error("pkg file is too small or corrupted");
             goto bail;
         }
-
-        while (encrypted_offset != encrypted_size)
-        {
-            uint32_t read = (uint32_t)min64(sizeof(down), encrypted_size - encrypted_offset);
-            int size = download_data(down, read, 1, 1);
-            if (size <= 0)
-            {
-                goto bail;
-            }
-        }
-
-        pkgi_close(item_file);
-        item_file = NULL;
     }
 
-    item_index = -1;
-
-    LOG("all files decrypted");
+    LOG("tail.bin downloaded");
     result = 1;
 
 bail:
-    if (item_file)
-    {
-        pkgi_close(item_file);
-        item_file = NULL;
-    }
+    download_close_file();
     return result;
 }
 
-static int download_tail(void)
+static uint8_t hexvalue(char ch)
 {
-    LOG("downloading tail.bin");
+    if (ch >= '0' && ch <= '9') return (uint8_t)(ch - '0');
+    if (ch >= 'a' && ch <= 'f') return (uint8_t)(ch - 'a' + 10);
+    if (ch >= 'A' && ch <= 'F') return (uint8_t)(ch - 'A' + 10);
+    return 0xff;
+}
 
-    int result = 0;
+// reads next sha256 from chunk manifest, which has one hex digest per line
+static int parse_chunk_digest(const char** text, const char* end, uint8_t* digest)
+{
+    const char* ptr = *text;
+    while (ptr < end && (*ptr == ' ' || *ptr == '\r' || *ptr == '\n'))
+    {
+        ptr++;
+    }
 
-    pkgi_strncpy(item_name, sizeof(item_name), "Finishing...");
-    pkgi_snprintf(item_path, sizeof(item_path), "%s/sce_sys/package/tail.bin", root);
+    if (end - ptr < 2 * SHA256_DIGEST_SIZE)
+    {
+        return 0;
+    }
 
-    if (download_resume)
+    for (uint32_t i = 0; i < SHA256_DIGEST_SIZE; i++)
     {
-        download_start();
+        uint8_t hi = hexvalue(ptr[2 * i + 0]);
+        uint8_t lo = hexvalue(ptr[2 * i + 1]);
+        if (hi > 15 || lo > 15)
+        {
+            return 0;
+        }
+        digest[i] = (uint8_t)(hi << 4) | lo;
     }
 
-    if (!create_file())
+    *text = ptr + 2 * SHA256_DIGEST_SIZE;
+    return 1;
+}
+
+static char* load_chunk_manifest(uint32_t* size)
+{
+    char url[512];
+    pkgi_snprintf(url, sizeof(url), "%s.chunks", download_url);
+    LOG("requesting chunk manifest %s", url);
+
+    pkgi_http* manifest = pkgi_http_get(url, NULL, 0);
+    if (!manifest)
     {
-        char error[256];
-        pkgi_snprintf(error, sizeof(error), "cannot create %s", item_path);
-        pkgi_dialog_error(error);
+        return NULL;
+    }
+
+    char* text = NULL;
+    int64_t length;
+    if (!pkgi_http_response_length(manifest, &length) || length <= 0 || length > CHUNK_MANIFEST_MAX_SIZE)
+    {
+        LOG("chunk manifest is not available");
         goto bail;
     }
 
-    uint64_t tail_offset = enc_offset + enc_size;
-    while (download_offset < tail_offset)
+    text = pkgi_malloc((uint32_t)length);
+    if (!text)
     {
-        uint32_t read = (uint32_t)min64(sizeof(down), tail_offset - download_offset);
-        int size = download_data(down, read, 0, 0);
-        if (size <= 0)
+        goto bail;
+    }
+
+    uint32_t received = 0;
+    while (received != (uint32_t)length)
+    {
+        int read = pkgi_http_read(manifest, text + received, (uint32_t)length - received);
+        if (read <= 0)
         {
+            LOG("failed to download chunk manifest");
+            pkgi_free(text);
+            text = NULL;
             goto bail;
         }
+        received += read;
     }
+    *size = received;
 
-    while (download_offset != total_size)
+bail:
+    pkgi_http_close(manifest);
+    return text;
+}
+
+// compares chunk hashes with manifest from server, if corrupted chunk is found then
+// writes resume file so download continues from beginning of that chunk
+static int find_corrupted_chunk(void)
+{
+    if (!chunks_enabled)
     {
-        uint32_t read = (uint32_t)min64(sizeof(down), total_size - download_offset);
-        int size = download_data(down, read, 0, 1);
-        if (size <= 0)
+        return 0;
+    }
+
+    uint32_t size;
+    char* manifest = load_chunk_manifest(&size);
+    if (!manifest)
+    {
+        return 0;
+    }
+
+    int found = 0;
+    void* f = pkgi_openrw(chunks_file);
+    if (!f)
+    {
+        goto bail;
+    }
+
+    const char* text = manifest;
+    const char* end = manifest + size;
+
+    ChunkRecord restart;
+    int restart_valid = 0;
+
+    for (uint64_t index = 0; index * CHUNK_SIZE < total_size; index++)
+    {
+        uint8_t expected[SHA256_DIGEST_SIZE];
+        if (!parse_chunk_digest(&text, end, expected))
         {
+            LOG("chunk manifest does not match pkg size");
             goto bail;
         }
+
+        // chunk may be missing if download was resumed in middle of it
+        ChunkRecord record;
+        uint8_t check[SHA256_DIGEST_SIZE];
+        int valid = pkgi_read(f, &record, sizeof(record)) == sizeof(record)
+            && record.start.magic == RESUME_MAGIC
+            && record.start.offset == index * CHUNK_SIZE;
+        if (valid)
+        {
+            checkpoint_digest(&record.start, check);
+            valid = pkgi_memequ(check, record.start.check, sizeof(check));
+        }
+
+        if (valid)
+        {
+            restart = record;
+            restart_valid = 1;
+            if (pkgi_memequ(expected, record.digest, sizeof(expected)))
+            {
+                continue;
+            }
+        }
+
+        LOG("chunk %llu is corrupted or missing", index);
+        found = restart_valid && restart.start.offset != 0;
+        break;
     }
 
-    LOG("tail.bin downloaded");
-    result = 1;
+    if (found)
+    {
+        // saved file has only slot 0, so sequence must be even, otherwise next checkpoint
+        // would go to slot 0 too and overwrite the only valid one
+        restart.start.sequence = 0;
+        checkpoint_digest(&restart.start, restart.start.check);
+
+        LOG("restarting download from %llu offset", restart.start.offset);
+        found = pkgi_save(resume_file, &restart.start, sizeof(restart.start));
+    }
 
 bail:
-    if (item_file != NULL)
+    if (f)
     {
-        pkgi_close(item_file);
-        item_file = NULL;
+        pkgi_close(f);
     }
-    return result;
+    pkgi_free(manifest);
+    return found;
 }
 
 static int check_integrity(const uint8_t* digest)
@@ -674,18 +2427,38 @@ static int check_integrity(const uint8_t* digest)
         return 1;
     }
 
+    if (chunk_valid)
+    {
+        // last chunk is not followed by another one, pipeline is idle after download_sync, so save it here
+        ChunkRecord record;
+        record.start = chunk_start;
+        sha256_finish(&chunk_sha, record.digest);
+        write_chunk(&record);
+        chunk_valid = 0;
+    }
+
     uint8_t check[SHA256_DIGEST_SIZE];
     sha256_finish(&sha, check);
 
     LOG("checking integrity of pkg");
     if (!pkgi_memequ(digest, check, SHA256_DIGEST_SIZE))
     {
+        if (!chunks_repair && find_corrupted_chunk())
+        {
+            LOG("pkg integrity is wrong, downloading corrupted part again");
+            chunks_repair = 1;
+            return 0;
+        }
+
         LOG("pkg integrity is wrong, removing head.bin & resume data");
 
         char path[256];
         pkgi_snprintf(path, sizeof(path), "%s/sce_sys/package/head.bin", root);
         pkgi_rm(path);
+        pkgi_rm(resume_file);
+        pkgi_rm(chunks_file);
 
+        chunks_repair = 0;
         pkgi_dialog_error("pkg integrity failed, try downloading again");
         return 0;
     }
@@ -714,44 +2487,94 @@ static int create_rif(const uint8_t* rif)
     return 1;
 }
 
-int pkgi_download(const char* content, const char* url, const uint8_t* rif, const uint8_t* digest)
+static int download_begin(const Config* config)
 {
-    int result = 0;
-
-    pkgi_snprintf(root, sizeof(root), "%s/%.9s", pkgi_get_temp_folder(), content + 7);
-    LOG("temp installation folder: %s", root);
-
-    pkgi_snprintf(resume_file, sizeof(resume_file), "%s/%.9s.resume", pkgi_get_temp_folder(), content + 7);
-    if (pkgi_load(resume_file, &sha, sizeof(sha)) == sizeof(sha))
+    if (load_resume())
     {
-        LOG("resume file exists, trying to resume");
+        LOG("resume file exists, trying to resume from %llu offset", resume.offset);
         pkgi_dialog_set_progress_title("Resuming");
         download_resume = 1;
+        sha = resume.sha;
     }
     else
     {
         LOG("cannot load resume file, starting download from scratch");
         pkgi_dialog_set_progress_title("Downloading");
         download_resume = 0;
+        pkgi_rm(resume_file);
+        pkgi_rm(chunks_file);
+        resume.offset = 0;
+        resume.sequence = 0;
         sha256_init(&sha);
     }
+    checkpoint_offset = resume.offset;
+    checkpoint_time = pkgi_time_msec();
+    checkpoint_sequence = resume.sequence;
+    checkpoint_count = 0;
+    checkpoint_msec = 0;
 
     http = NULL;
     item_file = NULL;
+    item_open = 0;
     item_index = -1;
     download_size = 0;
     download_offset = 0;
-    download_content = content;
-    download_url = url;
+    download_connections = config->connections;
+    download_preallocate = config->preallocate;
+    download_ranged = 0;
+    download_reading = 0;
+    download_range_end = 0;
+    total_size = 0;
+    index_size = 0;
+    index_items = NULL;
+    index_names = NULL;
 
     dialog_extra[0] = 0;
     dialog_eta[0] = 0;
     info_start = pkgi_time_msec();
     info_update = info_start + 1000;
 
+    if (!pipeline_start(config->write_buffer * 1024 * 1024))
+    {
+        pkgi_dialog_error("cannot start download threads");
+        return 0;
+    }
+    return 1;
+}
+
+static void download_end(void)
+{
+    pipeline_stop();
+    download_disconnect();
+    pkgi_free(index_items);
+    pkgi_free(index_names);
+}
+
+static int download_pkg(const uint8_t* rif, const uint8_t* digest, const Config* config)
+{
+    if (!download_begin(config))
+    {
+        return 0;
+    }
+
+    int result = 0;
+
     if (!download_head(rif)) goto finish;
-    if (!download_files()) goto finish;
+    if (download_preallocate && !download_resume)
+    {
+        if (!check_tree_space()) goto finish;
+    }
+    if (!create_folders()) goto finish;
+    if (local_file[0] && !download_resume)
+    {
+        if (!extract_files()) goto finish;
+    }
+    else
+    {
+        if (!download_files()) goto finish;
+    }
     if (!download_tail()) goto finish;
+    if (!download_sync()) goto finish;
     if (!check_integrity(digest)) goto finish;
     if (rif)
     {
@@ -759,12 +2582,228 @@ int pkgi_download(const char* content, const char* url, const uint8_t* rif, cons
     }
 
     pkgi_rm(resume_file);
+    pkgi_rm(chunks_file);
     result = 1;
 
 finish:
-    if (http)
+    download_end();
+
+    return result;
+}
+
+// pkg already in temp folder is installed directly, these are same paths pkgi_http_get checks
+static int find_local_pkg(void)
+{
+    const char* name = pkgi_strrchr(download_url, '/');
+    if (name)
+    {
+        pkgi_snprintf(local_file, sizeof(local_file), "%s%s", pkgi_get_temp_folder(), name);
+        if (pkgi_get_size(local_file) >= 0)
+        {
+            return 1;
+        }
+    }
+
+    pkgi_strncpy(local_file, sizeof(local_file), spool_file);
+    if (pkgi_get_size(local_file) >= 0)
+    {
+        return 1;
+    }
+
+    local_file[0] = 0;
+    return 0;
+}
+
+// downloads whole pkg to spool file as one sequential stream, nothing is decrypted or unpacked
+static int spool_data(const uint8_t* rif)
+{
+    LOG("downloading pkg to %s", spool_file);
+
+    int result = 0;
+
+    pkgi_strncpy(item_name, sizeof(item_name), pkgi_strrchr(spool_file, '/') + 1);
+    pkgi_snprintf(item_path, sizeof(item_path), "%s.part", spool_file);
+
+    uint8_t header[PKG_HEADER_SIZE];
+    if (download_resume)
+    {
+        // data before checkpoint is already hashed, only header is read back for pkg size
+        item_file = pkgi_openrw(item_path);
+        if (!item_file ||
+            resume.offset < sizeof(header) ||
+            pkgi_read(item_file, header, sizeof(header)) != sizeof(header) ||
+            !pkgi_seek(item_file, resume.offset))
+        {
+            LOG("%s cannot be resumed, starting download from scratch", item_path);
+            if (item_file)
+            {
+                pkgi_close(item_file);
+                item_file = NULL;
+            }
+            pkgi_rm(resume_file);
+            sha256_init(&sha);
+            resume.offset = 0;
+            checkpoint_offset = 0;
+        }
+        else
+        {
+            open_file();
+            download_offset = resume.offset;
+        }
+        download_start();
+    }
+
+    if (!item_open)
+    {
+        create_file(1, 0, 0);
+        if (!head_read(header, sizeof(header)))
+        {
+            goto bail;
+        }
+    }
+
+    if (get32be(header) != 0x7f504b47)
+    {
+        pkgi_dialog_error("wrong pkg header");
+        goto bail;
+    }
+
+    if (rif && !pkgi_memequ(rif + 0x10, header + 0x30, 0x30))
+    {
+        pkgi_dialog_error("zRIF content id doesn't match pkg");
+        goto bail;
+    }
+
+    total_size = get64be(header + 24);
+    if (total_size < download_offset)
+    {
+        pkgi_dialog_error("pkg file is too small or corrupted");
+        goto bail;
+    }
+    LOG("total_size=%llu", total_size);
+
+    // whole pkg can be downloaded over multiple connections
+    download_range_end = total_size;
+    if (http && download_connections > 1)
     {
         pkgi_http_close(http);
+        http = NULL;
+    }
+
+    while (download_offset != total_size)
+    {
+        uint32_t read = (uint32_t)min64(DOWNLOAD_BLOCK_SIZE, total_size - download_offset);
+        if (download_data(NULL, read, 0, 1) <= 0)
+        {
+            goto bail;
+        }
+    }
+
+    LOG("pkg downloaded");
+    result = 1;
+
+bail:
+    download_close_file();
+    return result;
+}
+
+static int spool_pkg(const uint8_t* rif, const uint8_t* digest, const Config* config)
+{
+    if (!download_begin(config))
+    {
+        return 0;
+    }
+
+    int result = 0;
+
+    if (!spool_data(rif)) goto finish;
+    if (!download_sync()) goto finish;
+    if (!check_integrity(digest))
+    {
+        if (!chunks_repair)
+        {
+            pkgi_rm(item_path);
+        }
+        goto finish;
+    }
+
+    if (!pkgi_rename(item_path, spool_file))
+    {
+        char error[256];
+        pkgi_snprintf(error, sizeof(error), "cannot rename %s", item_path);
+        pkgi_dialog_error(error);
+        goto finish;
+    }
+
+    pkgi_rm(resume_file);
+    pkgi_rm(chunks_file);
+    result = 1;
+
+finish:
+    download_end();
+
+    return result;
+}
+
+int pkgi_download(const char* content, const char* url, const uint8_t* rif, const uint8_t* digest, const Config* config)
+{
+    pkgi_snprintf(root, sizeof(root), "%s/%.9s", pkgi_get_temp_folder(), content + 7);
+    LOG("temp installation folder: %s", root);
+
+    pkgi_snprintf(spool_file, sizeof(spool_file), "%s/%s.pkg", pkgi_get_temp_folder(), content);
+
+    download_url = url;
+    chunks_repair = 0;
+
+    // set only when pkg was spooled here, local pkg placed by user must be kept
+    int spooled = 0;
+    if (config->spool && !find_local_pkg())
+    {
+        LOG("spooling pkg to %s", spool_file);
+
+        pkgi_snprintf(resume_file, sizeof(resume_file), "%s/%.9s.spool", pkgi_get_temp_folder(), content + 7);
+        pkgi_snprintf(chunks_file, sizeof(chunks_file), "%s/%.9s.spool.chunks", pkgi_get_temp_folder(), content + 7);
+
+        // spool always downloads from url, pkg in temp folder is only partial
+        download_content = NULL;
+        chunks_enabled = digest != NULL;
+        download_skip_unused = 0;
+
+        spooled = spool_pkg(rif, digest, config);
+        if (!spooled && chunks_repair)
+        {
+            spooled = spool_pkg(rif, digest, config);
+        }
+        chunks_repair = 0;
+
+        if (!spooled)
+        {
+            return 0;
+        }
+
+        // integrity is already checked, so unpacking can skip data not used by any file
+        digest = NULL;
+    }
+    find_local_pkg();
+
+    pkgi_snprintf(resume_file, sizeof(resume_file), "%s/%.9s.resume", pkgi_get_temp_folder(), content + 7);
+    pkgi_snprintf(chunks_file, sizeof(chunks_file), "%s/%.9s.chunks", pkgi_get_temp_folder(), content + 7);
+
+    download_content = content;
+    chunks_enabled = digest != NULL;
+    download_skip_unused = digest == NULL;
+
+    int result = download_pkg(rif, digest, config);
+    if (!result && chunks_repair)
+    {
+        result = download_pkg(rif, digest, config);
+    }
+    chunks_repair = 0;
+
+    if (result && spooled)
+    {
+        // spooled pkg is not needed after it is unpacked
+        pkgi_rm(spool_file);
     }
 
     return result;
@@ -4,4 +4,9 @@
 
 #define PKGI_RIF_SIZE 512
 
-int pkgi_download(const char* content, const char* url, const uint8_t* rif, const uint8_t* digest);
+// default size of write buffer in MB
+#define PKGI_WRITE_BUFFER_SIZE 4
+
+typedef struct Config Config;
+
+int pkgi_download(const char* content, const char* url, const uint8_t* rif, const uint8_t* digest, const Config* config);
@@ -0,0 +1,74 @@
+#include "pkgi_keystream.h"
+#include "pkgi.h"
+
+void pkgi_keystream_init(pkgi_keystream* ks, const aes128_ctx* aes, const uint8_t* iv)
+{
+    ks->aes = aes;
+    ks->iv = iv;
+    ks->start = 0;
+    ks->end = 0;
+    ks->valid = 0;
+    ks->prefetched = 0;
+    ks->computed = 0;
+    ks->generate_msec = 0;
+}
+
+int pkgi_keystream_generate(pkgi_keystream* ks)
+{
+    if (!ks->valid || ks->end + PKGI_KEYSTREAM_STEP - ks->start > PKGI_KEYSTREAM_SIZE)
+    {
+        return 0;
+    }
+
+    // aes128_ctr handles offsets that are not block aligned, so end can be anywhere
+    uint32_t index = ks->end % PKGI_KEYSTREAM_SIZE;
+    uint32_t size = min32(PKGI_KEYSTREAM_STEP, PKGI_KEYSTREAM_SIZE - index);
+    for (uint32_t i = 0; i < size; i++)
+    {
+        ks->data[index + i] = 0;
+    }
+    uint32_t start = pkgi_time_msec();
+    aes128_ctr(ks->aes, ks->iv, ks->end, ks->data + index, size);
+    ks->generate_msec += pkgi_time_msec() - start;
+    ks->end += size;
+    return 1;
+}
+
+void pkgi_keystream_decrypt(pkgi_keystream* ks, uint8_t* buffer, uint64_t offset, uint32_t size)
+{
+    if (!ks->valid || offset < ks->start || offset > ks->end)
+    {
+        // not continuing after previous data, so generated keystream is useless
+        ks->start = ks->end = offset;
+        ks->valid = 1;
+    }
+
+    uint32_t prefetched = ks->end > offset ? (uint32_t)min64(size, ks->end - offset) : 0;
+    for (uint32_t done = 0; done != prefetched; )
+    {
+        uint32_t index = (offset + done) % PKGI_KEYSTREAM_SIZE;
+        uint32_t count = min32(prefetched - done, PKGI_KEYSTREAM_SIZE - index);
+        const uint8_t* key = ks->data + index;
+        uint8_t* data = buffer + done;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            data[i] ^= key[i];
+        }
+        done += count;
+    }
+
+    if (prefetched != size)
+    {
+        aes128_ctr_parallel(ks->aes, ks->iv, offset + prefetched, buffer + prefetched, size - prefetched);
+    }
+
+    ks->prefetched += prefetched;
+    ks->computed += size - prefetched;
+
+    // keystream before end of this data is not needed anymore
+    ks->start = offset + size;
+    if (ks->end < ks->start)
+    {
+        ks->end = ks->start;
+    }
+}
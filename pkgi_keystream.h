@@ -0,0 +1,28 @@
+#pragma once
+
+#include "pkgi_aes128.h"
+
+// CTR keystream depends only on offset, so it can be generated ahead while waiting for downloaded
+// data, then decrypting data that continues after previous one is only xor
+#define PKGI_KEYSTREAM_SIZE (256 * 1024)
+#define PKGI_KEYSTREAM_STEP (16 * 1024)
+
+typedef struct {
+    uint8_t data[PKGI_KEYSTREAM_SIZE] GCC_ALIGN(16); // byte for offset X is at X % PKGI_KEYSTREAM_SIZE
+    const aes128_ctx* aes;
+    const uint8_t* iv;
+    uint64_t start; // generated keystream is for [start, end) offsets
+    uint64_t end;
+    int valid;      // if start is known, set after first decrypted data
+
+    uint64_t prefetched;    // bytes decrypted with generated keystream
+    uint64_t computed;      // bytes decrypted after they were received
+    uint32_t generate_msec; // time spent generating keystream ahead
+} pkgi_keystream;
+
+// aes and iv must stay valid while keystream is used
+void pkgi_keystream_init(pkgi_keystream* ks, const aes128_ctx* aes, const uint8_t* iv);
+// generates next step of keystream, returns 0 if there is no space for more
+int pkgi_keystream_generate(pkgi_keystream* ks);
+// decrypts data at any offset, uses generated keystream if data continues after previous one
+void pkgi_keystream_decrypt(pkgi_keystream* ks, uint8_t* buffer, uint64_t offset, uint32_t size);
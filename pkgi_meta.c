@@ -0,0 +1,280 @@
+#include "pkgi_meta.h"
+#include "pkgi.h"
+#include "pkgi_utils.h"
+
+#include <stddef.h>
+
+#define PKGI_META_CLOSES 16
+
+typedef enum {
+    MetaMkdir,
+    MetaCreate,
+} MetaType;
+
+typedef struct {
+    MetaType type;
+    uint64_t reserve;  // bytes to preallocate for file
+    void* file;        // created file
+    const char* error; // NULL on success
+    void* ready;       // signalled when operation is finished
+    char path[256];
+} MetaOp;
+
+static MetaOp meta_ops[PKGI_META_AHEAD];
+static uint32_t meta_queued;   // only used by thread that queues operations
+static uint32_t meta_finished; // only used by worker
+static uint32_t meta_taken;    // only used by thread that takes results
+
+static void* meta_closes[PKGI_META_CLOSES]; // NULL is flush request
+static uint32_t meta_close_write;
+static uint32_t meta_close_read;
+static int meta_quit;
+static int meta_running;
+
+static void* meta_lock;       // protects meta_closes and meta_quit
+static void* meta_work;       // counts queued operations, closes and quit request
+static void* meta_free;       // counts free operation slots
+static void* meta_close_free; // counts free close slots
+static void* meta_flushed;    // signalled when flush request is reached
+static void* meta_done;       // signalled when thread exits
+
+static uint32_t meta_closed;
+static uint32_t meta_sync_msec;  // time spent syncing closed files
+static uint32_t meta_stalls;     // times when result was not ready when taken
+static uint32_t meta_stall_msec;
+
+static void meta_execute(MetaOp* op)
+{
+    op->file = NULL;
+    op->error = NULL;
+
+    if (op->type == MetaMkdir)
+    {
+        if (!pkgi_mkdir(op->path))
+        {
+            op->error = "cannot create folder";
+        }
+        return;
+    }
+
+    op->file = pkgi_create(op->path);
+    if (!op->file)
+    {
+        op->error = "cannot create file";
+    }
+    else if (op->reserve != 0 && !pkgi_preallocate(op->file, op->reserve))
+    {
+        pkgi_close(op->file);
+        op->file = NULL;
+        op->error = "not enough free space for";
+    }
+}
+
+static void pkgi_meta_thread(void)
+{
+    for (;;)
+    {
+        pkgi_sema_wait(meta_work);
+
+        // closes go first, so flush does not wait for files created ahead
+        pkgi_sema_wait(meta_lock);
+        int closing = meta_close_read != meta_close_write;
+        void* file = closing ? meta_closes[meta_close_read++ % PKGI_META_CLOSES] : NULL;
+        int quit = !closing && meta_quit;
+        pkgi_sema_signal(meta_lock);
+
+        if (closing)
+        {
+            if (file)
+            {
+                // resume checkpoint written after flush must not refer to data that is only cached
+                uint32_t start = pkgi_time_msec();
+                pkgi_sync(file);
+                meta_sync_msec += pkgi_time_msec() - start;
+
+                pkgi_close(file);
+                meta_closed++;
+            }
+            else
+            {
+                pkgi_sema_signal(meta_flushed);
+            }
+            pkgi_sema_signal(meta_close_free);
+        }
+        else if (quit)
+        {
+            break;
+        }
+        else
+        {
+            MetaOp* op = meta_ops + meta_finished % PKGI_META_AHEAD;
+            meta_execute(op);
+            meta_finished++;
+            pkgi_sema_signal(op->ready);
+        }
+    }
+
+    pkgi_sema_signal(meta_done);
+}
+
+static void meta_destroy_sema(void** sema)
+{
+    if (*sema)
+    {
+        pkgi_sema_destroy(*sema);
+        *sema = NULL;
+    }
+}
+
+static void meta_destroy(void)
+{
+    for (uint32_t i = 0; i < PKGI_META_AHEAD; i++)
+    {
+        meta_destroy_sema(&meta_ops[i].ready);
+    }
+
+    meta_destroy_sema(&meta_lock);
+    meta_destroy_sema(&meta_work);
+    meta_destroy_sema(&meta_free);
+    meta_destroy_sema(&meta_close_free);
+    meta_destroy_sema(&meta_flushed);
+    meta_destroy_sema(&meta_done);
+}
+
+int pkgi_meta_start(void)
+{
+    meta_queued = 0;
+    meta_finished = 0;
+    meta_taken = 0;
+    meta_close_write = 0;
+    meta_close_read = 0;
+    meta_quit = 0;
+    meta_closed = 0;
+    meta_sync_msec = 0;
+    meta_stalls = 0;
+    meta_stall_msec = 0;
+
+    meta_lock = pkgi_sema_create("meta_lock", 1, 1);
+    meta_work = pkgi_sema_create("meta_work", 0, PKGI_META_AHEAD + PKGI_META_CLOSES + 1);
+    meta_free = pkgi_sema_create("meta_free", PKGI_META_AHEAD, PKGI_META_AHEAD);
+    meta_close_free = pkgi_sema_create("meta_close_free", PKGI_META_CLOSES, PKGI_META_CLOSES);
+    meta_flushed = pkgi_sema_create("meta_flushed", 0, 1);
+    meta_done = pkgi_sema_create("meta_done", 0, 1);
+    if (!meta_lock || !meta_work || !meta_free || !meta_close_free || !meta_flushed || !meta_done)
+    {
+        meta_destroy();
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < PKGI_META_AHEAD; i++)
+    {
+        meta_ops[i].ready = pkgi_sema_create("meta_ready", 0, 1);
+        if (!meta_ops[i].ready)
+        {
+            meta_destroy();
+            return 0;
+        }
+    }
+
+    if (!pkgi_start_thread("meta_thread", &pkgi_meta_thread))
+    {
+        meta_destroy();
+        return 0;
+    }
+    meta_running = 1;
+
+    return 1;
+}
+
+void pkgi_meta_stop(void)
+{
+    if (!meta_running)
+    {
+        return;
+    }
+
+    pkgi_sema_wait(meta_lock);
+    meta_quit = 1;
+    pkgi_sema_signal(meta_lock);
+    pkgi_sema_signal(meta_work);
+    pkgi_sema_wait(meta_done);
+    meta_running = 0;
+
+    // files created ahead that will not be written anymore
+    for (uint32_t i = meta_taken; i != meta_finished; i++)
+    {
+        MetaOp* op = meta_ops + i % PKGI_META_AHEAD;
+        if (op->file)
+        {
+            pkgi_close(op->file);
+        }
+    }
+
+    LOG("metadata worker: %u created, %u taken, %u closed (%u ms syncing), %u stalls (%u ms)",
+        meta_finished, meta_taken, meta_closed, meta_sync_msec, meta_stalls, meta_stall_msec);
+
+    meta_destroy();
+}
+
+static void meta_queue(MetaType type, const char* path, uint64_t reserve)
+{
+    pkgi_sema_wait(meta_free);
+
+    MetaOp* op = meta_ops + meta_queued++ % PKGI_META_AHEAD;
+    op->type = type;
+    op->reserve = reserve;
+    pkgi_strncpy(op->path, sizeof(op->path), path);
+
+    pkgi_sema_signal(meta_work);
+}
+
+void pkgi_meta_mkdir(const char* path)
+{
+    meta_queue(MetaMkdir, path, 0);
+}
+
+void pkgi_meta_create(const char* path, uint64_t reserve)
+{
+    meta_queue(MetaCreate, path, reserve);
+}
+
+const char* pkgi_meta_take(void** file)
+{
+    MetaOp* op = meta_ops + meta_taken % PKGI_META_AHEAD;
+    if (!pkgi_sema_poll(op->ready))
+    {
+        uint32_t start = pkgi_time_msec();
+        pkgi_sema_wait(op->ready);
+        meta_stalls++;
+        meta_stall_msec += pkgi_time_msec() - start;
+    }
+
+    *file = op->file;
+    const char* error = op->error;
+    meta_taken++;
+
+    pkgi_sema_signal(meta_free);
+    return error;
+}
+
+static void meta_push_close(void* file)
+{
+    pkgi_sema_wait(meta_close_free);
+
+    pkgi_sema_wait(meta_lock);
+    meta_closes[meta_close_write++ % PKGI_META_CLOSES] = file;
+    pkgi_sema_signal(meta_lock);
+
+    pkgi_sema_signal(meta_work);
+}
+
+void pkgi_meta_close(void* file)
+{
+    meta_push_close(file);
+}
+
+void pkgi_meta_flush(void)
+{
+    meta_push_close(NULL);
+    pkgi_sema_wait(meta_flushed);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// how many folders & files can be queued and not yet taken
+#define PKGI_META_AHEAD 16
+
+// background thread that creates folders & files ahead of time and closes files after they are written,
+// so thread that writes data does not wait for slow filesystem metadata operations
+int pkgi_meta_start(void);
+// closes files that were created but not taken
+void pkgi_meta_stop(void);
+
+// queues creation of folder or file, waits if PKGI_META_AHEAD operations are not taken yet
+void pkgi_meta_mkdir(const char* path);
+void pkgi_meta_create(const char* path, uint64_t reserve);
+// returns result of oldest operation that is not taken, waits if it is not finished,
+// on success returns NULL and created file (NULL for folders), otherwise returns error message
+const char* pkgi_meta_take(void** file);
+
+// file is synced to storage and closed in background
+void pkgi_meta_close(void* file);
+// waits until all files passed to pkgi_meta_close are synced and closed
+void pkgi_meta_flush(void);
@@ -0,0 +1,264 @@
+#include "pkgi_range.h"
+#include "pkgi.h"
+#include "pkgi_utils.h"
+
+#include <stddef.h>
+
+// range is split into fixed size segments, each connection downloads next free segment
+// into its own slot, reader consumes slots in order - so there is always a small window
+// of segments downloading in parallel ahead of the reader
+#define PKGI_RANGE_SEGMENT_SIZE (1024 * 1024)
+#define PKGI_RANGE_SLOTS_PER_CONNECTION 2
+#define PKGI_RANGE_MAX_SLOTS (PKGI_RANGE_SLOTS_PER_CONNECTION * PKGI_RANGE_MAX_CONNECTIONS)
+#define PKGI_RANGE_RETRIES 3
+
+typedef struct {
+    void* ready;   // signalled when segment is downloaded or failed
+    uint32_t size;
+    int error;
+    uint8_t* data; // PKGI_RANGE_SEGMENT_SIZE bytes in range_buffer
+} RangeSlot;
+
+static RangeSlot range_slots[PKGI_RANGE_MAX_SLOTS];
+static uint32_t range_slot_count; // slots used for current connection count
+static uint8_t* range_buffer;     // data of all used slots
+
+static const char* range_url;
+static uint64_t range_offset;
+static uint64_t range_end;
+static uint32_t range_count;      // total segment count
+static uint32_t range_next;       // next segment to download
+static uint32_t range_current;    // segment that is currently read
+static uint32_t range_position;   // read position in current segment
+static int range_acquired;        // if current segment is downloaded
+static uint32_t range_connections;
+static volatile int range_abort;
+
+static void* range_lock; // protects range_next
+static void* range_free; // counts free slots
+static void* range_done; // signalled when thread exits
+
+static int range_fetch(uint8_t* data, uint64_t offset, uint32_t size)
+{
+    int error = -1;
+    uint32_t received = 0;
+
+    for (uint32_t attempt = 0; attempt < PKGI_RANGE_RETRIES && !range_abort; attempt++)
+    {
+        pkgi_http* http = pkgi_http_get_range(range_url, offset + received, offset + size);
+        if (!http)
+        {
+            LOG("cannot send HTTP request for %llu offset", offset + received);
+            continue;
+        }
+
+        int64_t length;
+        if (!pkgi_http_response_length(http, &length) || length != size - received)
+        {
+            // server ignored Range header, retrying will not help
+            LOG("HTTP range request failed for %llu offset", offset + received);
+            pkgi_http_close(http);
+            return -1;
+        }
+
+        while (received != size && !range_abort)
+        {
+            int read = pkgi_http_read(http, data + received, size - received);
+            if (read <= 0)
+            {
+                LOG("HTTP read failed at %llu offset, error 0x%08x", offset + received, read);
+                if (read < 0)
+                {
+                    error = read;
+                }
+                break;
+            }
+            received += read;
+        }
+
+        pkgi_http_close(http);
+
+        if (received == size)
+        {
+            return 0;
+        }
+    }
+
+    return error;
+}
+
+static void pkgi_range_thread(void)
+{
+    for (;;)
+    {
+        pkgi_sema_wait(range_free);
+
+        pkgi_sema_wait(range_lock);
+        uint32_t segment = range_next;
+        int finished = range_abort || segment == range_count;
+        if (!finished)
+        {
+            range_next++;
+        }
+        pkgi_sema_signal(range_lock);
+
+        if (finished)
+        {
+            // pass free slot to next waiting thread so it can exit too
+            pkgi_sema_signal(range_free);
+            break;
+        }
+
+        RangeSlot* slot = range_slots + segment % range_slot_count;
+        uint64_t offset = range_offset + (uint64_t)segment * PKGI_RANGE_SEGMENT_SIZE;
+
+        slot->size = (uint32_t)min64(PKGI_RANGE_SEGMENT_SIZE, range_end - offset);
+        slot->error = range_fetch(slot->data, offset, slot->size);
+        pkgi_sema_signal(slot->ready);
+    }
+
+    pkgi_sema_signal(range_done);
+}
+
+static void range_destroy(void)
+{
+    for (uint32_t i = 0; i < PKGI_RANGE_MAX_SLOTS; i++)
+    {
+        if (range_slots[i].ready)
+        {
+            pkgi_sema_destroy(range_slots[i].ready);
+            range_slots[i].ready = NULL;
+        }
+    }
+    if (range_done)
+    {
+        pkgi_sema_destroy(range_done);
+        range_done = NULL;
+    }
+    if (range_free)
+    {
+        pkgi_sema_destroy(range_free);
+        range_free = NULL;
+    }
+    if (range_lock)
+    {
+        pkgi_sema_destroy(range_lock);
+        range_lock = NULL;
+    }
+    pkgi_free(range_buffer);
+    range_buffer = NULL;
+}
+
+int pkgi_range_start(const char* url, uint64_t offset, uint64_t end, uint32_t connections)
+{
+    connections = min32(connections, PKGI_RANGE_MAX_CONNECTIONS);
+    LOG("downloading %llu-%llu range with %u connections", offset, end, connections);
+
+    range_url = url;
+    range_offset = offset;
+    range_end = end;
+    range_count = (uint32_t)((end - offset + PKGI_RANGE_SEGMENT_SIZE - 1) / PKGI_RANGE_SEGMENT_SIZE);
+    range_next = 0;
+    range_current = 0;
+    range_position = 0;
+    range_acquired = 0;
+    range_connections = 0;
+    range_abort = 0;
+
+    // memory for slots is used only while range is downloading, and only as much as connections need
+    range_slot_count = PKGI_RANGE_SLOTS_PER_CONNECTION * connections;
+    range_buffer = pkgi_malloc(range_slot_count * PKGI_RANGE_SEGMENT_SIZE);
+    if (!range_buffer)
+    {
+        LOG("cannot allocate %u bytes for range download", range_slot_count * PKGI_RANGE_SEGMENT_SIZE);
+        return 0;
+    }
+
+    range_lock = pkgi_sema_create("range_lock", 1, 1);
+    range_free = pkgi_sema_create("range_free", range_slot_count, range_slot_count + PKGI_RANGE_MAX_CONNECTIONS);
+    range_done = pkgi_sema_create("range_done", 0, PKGI_RANGE_MAX_CONNECTIONS);
+    if (!range_lock || !range_free || !range_done)
+    {
+        range_destroy();
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < range_slot_count; i++)
+    {
+        range_slots[i].data = range_buffer + i * PKGI_RANGE_SEGMENT_SIZE;
+        range_slots[i].ready = pkgi_sema_create("range_ready", 0, 1);
+        if (!range_slots[i].ready)
+        {
+            range_destroy();
+            return 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < connections; i++)
+    {
+        if (!pkgi_start_thread("range_thread", &pkgi_range_thread))
+        {
+            break;
+        }
+        range_connections++;
+    }
+
+    if (range_connections == 0)
+    {
+        range_destroy();
+        return 0;
+    }
+
+    return 1;
+}
+
+int pkgi_range_read(void* buffer, uint32_t size)
+{
+    if (range_current == range_count)
+    {
+        return 0;
+    }
+
+    RangeSlot* slot = range_slots + range_current % range_slot_count;
+    if (!range_acquired)
+    {
+        pkgi_sema_wait(slot->ready);
+        range_acquired = 1;
+    }
+
+    if (slot->error < 0)
+    {
+        return slot->error;
+    }
+
+    uint32_t read = min32(size, slot->size - range_position);
+    pkgi_memcpy(buffer, slot->data + range_position, read);
+    range_position += read;
+
+    if (range_position == slot->size)
+    {
+        range_current++;
+        range_position = 0;
+        range_acquired = 0;
+        pkgi_sema_signal(range_free);
+    }
+
+    return read;
+}
+
+void pkgi_range_stop(void)
+{
+    LOG("stopping range download");
+
+    range_abort = 1;
+    for (uint32_t i = 0; i < range_connections; i++)
+    {
+        pkgi_sema_signal(range_free);
+    }
+    for (uint32_t i = 0; i < range_connections; i++)
+    {
+        pkgi_sema_wait(range_done);
+    }
+
+    range_destroy();
+}
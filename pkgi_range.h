@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PKGI_RANGE_MAX_CONNECTIONS 4
+// more connections help only when server limits speed of every connection, on unlimited
+// local server they are slower (pkgi_bench download results), so they must be enabled in config
+#define PKGI_RANGE_DEFAULT_CONNECTIONS 1
+
+// downloads [offset, end) bytes of url over multiple parallel Range requests
+int pkgi_range_start(const char* url, uint64_t offset, uint64_t end, uint32_t connections);
+// returns next downloaded bytes in order, 0 when everything is read, negative http error on failure
+int pkgi_range_read(void* buffer, uint32_t size);
+void pkgi_range_stop(void);
@@ -0,0 +1,254 @@
+#include "pkgi_reader.h"
+#include "pkgi.h"
+#include "pkgi_utils.h"
+
+#include <stddef.h>
+
+// if platform can map file into memory, data is returned directly from mapping without any copy,
+// otherwise background thread reads file ahead into fixed size slots, so reading from storage
+// overlaps with hashing and decrypting of data that was read before
+#define PKGI_READER_SLOT_SIZE (256 * 1024)
+#define PKGI_READER_SLOTS 4
+
+typedef struct {
+    void* ready; // signalled when slot is read or failed
+    int size;    // negative on failure
+    uint8_t data[PKGI_READER_SLOT_SIZE] GCC_ALIGN(16);
+} ReaderSlot;
+
+static ReaderSlot reader_slots[PKGI_READER_SLOTS];
+
+static const uint8_t* reader_map; // whole file, if it is mapped
+static uint64_t reader_map_size;
+
+static void* reader_file;
+static uint64_t reader_start;     // offset where reading started
+static uint64_t reader_offset;    // next offset to return
+static uint64_t reader_end;
+static uint32_t reader_count;     // total slot count
+static uint32_t reader_current;   // slot that is currently read
+static uint32_t reader_position;  // read position in current slot
+static int reader_acquired;       // if current slot is read
+static int reader_running;        // if reader thread is started
+static volatile int reader_abort;
+
+static void* reader_free; // counts free slots
+static void* reader_done; // signalled when thread exits
+
+static uint32_t reader_start_msec;
+static uint32_t reader_stalls;     // times when data was not read ahead
+static uint32_t reader_stall_msec;
+
+static void pkgi_reader_thread(void)
+{
+    for (uint32_t index = 0; index < reader_count; index++)
+    {
+        pkgi_sema_wait(reader_free);
+        if (reader_abort)
+        {
+            break;
+        }
+
+        ReaderSlot* slot = reader_slots + index % PKGI_READER_SLOTS;
+        uint64_t offset = reader_start + (uint64_t)index * PKGI_READER_SLOT_SIZE;
+        uint32_t size = (uint32_t)min64(PKGI_READER_SLOT_SIZE, reader_end - offset);
+
+        uint32_t received = 0;
+        while (received != size)
+        {
+            int read = pkgi_read(reader_file, slot->data + received, size - received);
+            if (read <= 0)
+            {
+                LOG("failed to read file at %llu offset", offset + received);
+                break;
+            }
+            received += read;
+        }
+
+        slot->size = received == size ? (int)size : -1;
+        pkgi_sema_signal(slot->ready);
+
+        if (slot->size < 0)
+        {
+            break;
+        }
+    }
+
+    pkgi_sema_signal(reader_done);
+}
+
+static void reader_destroy(void)
+{
+    for (uint32_t i = 0; i < PKGI_READER_SLOTS; i++)
+    {
+        if (reader_slots[i].ready)
+        {
+            pkgi_sema_destroy(reader_slots[i].ready);
+            reader_slots[i].ready = NULL;
+        }
+    }
+    if (reader_done)
+    {
+        pkgi_sema_destroy(reader_done);
+        reader_done = NULL;
+    }
+    if (reader_free)
+    {
+        pkgi_sema_destroy(reader_free);
+        reader_free = NULL;
+    }
+    if (reader_file)
+    {
+        pkgi_close(reader_file);
+        reader_file = NULL;
+    }
+    if (reader_map)
+    {
+        pkgi_unmap(reader_map, reader_map_size);
+        reader_map = NULL;
+    }
+}
+
+int64_t pkgi_reader_start(const char* path, uint64_t offset)
+{
+    LOG("reading %s from %llu offset", path, offset);
+
+    reader_start = offset;
+    reader_offset = offset;
+    reader_current = 0;
+    reader_position = 0;
+    reader_acquired = 0;
+    reader_running = 0;
+    reader_abort = 0;
+    reader_start_msec = pkgi_time_msec();
+    reader_stalls = 0;
+    reader_stall_msec = 0;
+
+    reader_map = pkgi_map(path, &reader_map_size);
+    if (reader_map)
+    {
+        LOG("%s is mapped to memory", path);
+        if (offset > reader_map_size)
+        {
+            reader_destroy();
+            return -1;
+        }
+        reader_end = reader_map_size;
+        return reader_end - offset;
+    }
+
+    int64_t size = pkgi_get_size(path);
+    if (size < 0 || offset > (uint64_t)size)
+    {
+        return -1;
+    }
+    reader_end = size;
+    reader_count = (uint32_t)((reader_end - offset + PKGI_READER_SLOT_SIZE - 1) / PKGI_READER_SLOT_SIZE);
+
+    reader_file = pkgi_open(path);
+    reader_free = pkgi_sema_create("reader_free", PKGI_READER_SLOTS, PKGI_READER_SLOTS + 1);
+    reader_done = pkgi_sema_create("reader_done", 0, 1);
+    if (!reader_file || !pkgi_seek(reader_file, offset) || !reader_free || !reader_done)
+    {
+        reader_destroy();
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < PKGI_READER_SLOTS; i++)
+    {
+        reader_slots[i].ready = pkgi_sema_create("reader_ready", 0, 1);
+        if (!reader_slots[i].ready)
+        {
+            reader_destroy();
+            return -1;
+        }
+    }
+
+    if (!pkgi_start_thread("reader_thread", &pkgi_reader_thread))
+    {
+        reader_destroy();
+        return -1;
+    }
+    reader_running = 1;
+
+    return reader_end - offset;
+}
+
+int pkgi_reader_next(const uint8_t** data, uint32_t size)
+{
+    if (reader_map)
+    {
+        uint32_t read = (uint32_t)min64(size, reader_end - reader_offset);
+        *data = reader_map + reader_offset;
+        reader_offset += read;
+        return read;
+    }
+
+    ReaderSlot* slot = reader_slots + reader_current % PKGI_READER_SLOTS;
+    if (reader_acquired && reader_position == (uint32_t)slot->size)
+    {
+        // previous view is not used anymore, so slot can be read again
+        reader_current++;
+        reader_position = 0;
+        reader_acquired = 0;
+        pkgi_sema_signal(reader_free);
+
+        slot = reader_slots + reader_current % PKGI_READER_SLOTS;
+    }
+
+    if (reader_current == reader_count)
+    {
+        return 0;
+    }
+
+    if (!reader_acquired)
+    {
+        if (!pkgi_sema_poll(slot->ready))
+        {
+            uint32_t start = pkgi_time_msec();
+            pkgi_sema_wait(slot->ready);
+            reader_stalls++;
+            reader_stall_msec += pkgi_time_msec() - start;
+        }
+        reader_acquired = 1;
+    }
+
+    if (slot->size < 0)
+    {
+        return slot->size;
+    }
+
+    uint32_t read = min32(size, slot->size - reader_position);
+    *data = slot->data + reader_position;
+    reader_position += read;
+    reader_offset += read;
+
+    return read;
+}
+
+int pkgi_reader_read(void* buffer, uint32_t size)
+{
+    const uint8_t* data;
+    int read = pkgi_reader_next(&data, size);
+    if (read > 0)
+    {
+        pkgi_memcpy(buffer, data, read);
+    }
+    return read;
+}
+
+void pkgi_reader_stop(void)
+{
+    LOG("stopping reader at %llu offset after %u ms, %u stalls (%u ms)",
+        reader_offset, pkgi_time_msec() - reader_start_msec, reader_stalls, reader_stall_msec);
+
+    if (reader_running)
+    {
+        reader_abort = 1;
+        pkgi_sema_signal(reader_free);
+        pkgi_sema_wait(reader_done);
+        reader_running = 0;
+    }
+
+    reader_destroy();
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// reads local file sequentially from offset, returns size that will be read or -1 on failure
+int64_t pkgi_reader_start(const char* path, uint64_t offset);
+// returns view of next bytes (up to size) in data, view is valid until next call to reader,
+// 0 when everything is read, negative on failure
+int pkgi_reader_next(const uint8_t** data, uint32_t size);
+// same as pkgi_reader_next, but copies bytes to buffer
+int pkgi_reader_read(void* buffer, uint32_t size);
+void pkgi_reader_stop(void);
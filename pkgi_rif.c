@@ -0,0 +1,500 @@
+#include "pkgi_rif.h"
+#include "pkgi_download.h"
+#include "pkgi_zrif.h"
+#include "pkgi.h"
+#include "pkgi_utils.h"
+
+#include <stddef.h>
+
+// zRIF decoding is independent for every item, so items are split between threads
+#define PKGI_RIF_THREADS 2
+
+#define PKGI_RIF_MAGIC 0x46495250
+#define PKGI_RIF_CONTENT_SIZE 40 // content id is 36 characters, rest is zero
+
+// cache file has header followed by records sorted by content id
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} RifHeader;
+
+typedef struct {
+    char content[PKGI_RIF_CONTENT_SIZE];
+    uint32_t zrif_hash; // detects when list has different zRIF for same content id
+    uint8_t rif[PKGI_RIF_SIZE];
+} RifRecord;
+
+typedef struct {
+    uint32_t cached;
+    uint32_t decoded;
+    uint32_t broken;
+} RifStats;
+
+static RifRecord* rif_old; // records loaded from cache file
+static uint32_t rif_old_count;
+
+#define RIF_STATE_NONE 0   // item has no zRIF or was not processed
+#define RIF_STATE_VALID 1  // record for item is valid
+#define RIF_STATE_BROKEN 2 // zRIF cannot be decoded, published to item after pass
+
+static RifRecord* rif_records; // records for current list, in same order as items
+static uint8_t* rif_state;     // RIF_STATE_* for every item
+static uint32_t* rif_order;    // record indices sorted by content id
+static uint32_t rif_count;     // total items while pass is running, sorted records after that
+
+static RifStats rif_stats[PKGI_RIF_THREADS];
+static uint32_t rif_msec;     // duration of last finished pass
+static uint32_t rif_starting; // thread index for helper that is starting
+static int rif_running;       // if pass thread is started and not stopped yet
+static volatile int rif_abort;
+static int rif_finished;      // set after records are sorted and can be used by pkgi_rif_get
+
+// created once for whole run, so pkgi_rif_get can be called while pass is stopped or started again
+static void* rif_lock;        // protects rif_running, rif_finished and zrif_broken of items
+static void* rif_started;     // signalled when helper thread starts
+static void* rif_helper_done; // signalled when helper thread finishes
+static void* rif_done;        // signalled when pass finishes
+
+static void rif_key(char* key, const char* content)
+{
+    uint32_t i = 0;
+    for (; i < PKGI_RIF_CONTENT_SIZE && content[i]; i++)
+    {
+        key[i] = content[i];
+    }
+    for (; i < PKGI_RIF_CONTENT_SIZE; i++)
+    {
+        key[i] = 0;
+    }
+}
+
+static int rif_compare(const char* a, const char* b)
+{
+    for (uint32_t i = 0; i < PKGI_RIF_CONTENT_SIZE; i++)
+    {
+        if (a[i] != b[i])
+        {
+            return (uint8_t)a[i] < (uint8_t)b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// FNV-1a
+static uint32_t rif_hash(const char* str)
+{
+    uint32_t hash = 0x811c9dc5;
+    while (*str)
+    {
+        hash = (hash ^ (uint8_t)*str++) * 0x01000193;
+    }
+    return hash;
+}
+
+// binary search in records sorted by content id, order can be NULL when records are sorted
+static const RifRecord* rif_find(const RifRecord* records, const uint32_t* order, uint32_t count, const char* key)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+        const RifRecord* record = records + (order ? order[middle] : middle);
+
+        int cmp = rif_compare(record->content, key);
+        if (cmp == 0)
+        {
+            return record;
+        }
+        else if (cmp < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+static void rif_process(uint32_t thread)
+{
+    RifStats* stats = rif_stats + thread;
+
+    for (uint32_t i = thread; i < rif_count && !rif_abort; i += PKGI_RIF_THREADS)
+    {
+        DbItem* item = pkgi_db_get_unfiltered(i);
+        if (!item->zrif)
+        {
+            continue;
+        }
+
+        RifRecord* record = rif_records + i;
+        rif_key(record->content, item->content);
+        record->zrif_hash = rif_hash(item->zrif);
+
+        const RifRecord* old = rif_find(rif_old, NULL, rif_old_count, record->content);
+        if (old && old->zrif_hash == record->zrif_hash)
+        {
+            pkgi_memcpy(record->rif, old->rif, PKGI_RIF_SIZE);
+            rif_state[i] = RIF_STATE_VALID;
+            stats->cached++;
+            continue;
+        }
+
+        char error[256];
+        if (pkgi_zrif_decode(item->zrif, record->rif, error, sizeof(error)))
+        {
+            rif_state[i] = RIF_STATE_VALID;
+            stats->decoded++;
+        }
+        else
+        {
+            LOG("[%.9s] %s - %s", item->content + 7, item->name, error);
+            rif_state[i] = RIF_STATE_BROKEN;
+            stats->broken++;
+        }
+    }
+}
+
+static void pkgi_rif_helper(void)
+{
+    uint32_t thread = rif_starting;
+    pkgi_sema_signal(rif_started);
+
+    rif_process(thread);
+
+    pkgi_sema_signal(rif_helper_done);
+}
+
+static void rif_load(const char* path)
+{
+    int64_t size = pkgi_get_size(path);
+    if (size < (int64_t)sizeof(RifHeader) || (size - sizeof(RifHeader)) % sizeof(RifRecord) != 0)
+    {
+        return;
+    }
+
+    uint8_t* data = pkgi_malloc((uint32_t)size);
+    if (!data)
+    {
+        return;
+    }
+
+    const RifHeader* header = (const RifHeader*)data;
+    if (pkgi_load(path, data, (uint32_t)size) != size ||
+        header->magic != PKGI_RIF_MAGIC ||
+        header->count != (size - sizeof(RifHeader)) / sizeof(RifRecord))
+    {
+        LOG("ignoring invalid %s file", path);
+        pkgi_free(data);
+        return;
+    }
+
+    // header is 8 bytes, so records stay aligned
+    rif_old = (RifRecord*)(data + sizeof(RifHeader));
+    rif_old_count = header->count;
+}
+
+// shell sort of record indices by content id
+static void rif_sort(void)
+{
+    static const uint32_t gaps[] = { 1750, 701, 301, 132, 57, 23, 10, 4, 1 };
+
+    for (uint32_t g = 0; g < sizeof(gaps) / sizeof(*gaps); g++)
+    {
+        uint32_t gap = gaps[g];
+        for (uint32_t i = gap; i < rif_count; i++)
+        {
+            uint32_t index = rif_order[i];
+            uint32_t j = i;
+            while (j >= gap && rif_compare(rif_records[rif_order[j - gap]].content, rif_records[index].content) > 0)
+            {
+                rif_order[j] = rif_order[j - gap];
+                j -= gap;
+            }
+            rif_order[j] = index;
+        }
+    }
+}
+
+static void rif_save(const char* path)
+{
+    char temp[256];
+    pkgi_snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    void* f = pkgi_create(temp);
+    if (!f)
+    {
+        LOG("cannot create %s file", temp);
+        return;
+    }
+
+    RifHeader header = { PKGI_RIF_MAGIC, rif_count };
+    int ok = pkgi_write(f, &header, sizeof(header));
+    for (uint32_t i = 0; i < rif_count && ok; i++)
+    {
+        ok = pkgi_write(f, rif_records + rif_order[i], sizeof(RifRecord));
+    }
+    pkgi_close(f);
+
+    if (!ok)
+    {
+        LOG("cannot write %s file", temp);
+        pkgi_rm(temp);
+        return;
+    }
+
+    // replaced only after new file is fully written, so invalid cache is never loaded
+    if (pkgi_get_size(path) >= 0)
+    {
+        pkgi_rm(path);
+    }
+    pkgi_rename(temp, path);
+}
+
+static void rif_destroy(void)
+{
+    if (rif_started)
+    {
+        pkgi_sema_destroy(rif_started);
+        rif_started = NULL;
+    }
+    if (rif_helper_done)
+    {
+        pkgi_sema_destroy(rif_helper_done);
+        rif_helper_done = NULL;
+    }
+    if (rif_done)
+    {
+        pkgi_sema_destroy(rif_done);
+        rif_done = NULL;
+    }
+
+    if (rif_old)
+    {
+        pkgi_free((uint8_t*)rif_old - sizeof(RifHeader));
+        rif_old = NULL;
+    }
+    rif_old_count = 0;
+
+    pkgi_free(rif_records);
+    pkgi_free(rif_state);
+    pkgi_free(rif_order);
+    rif_records = NULL;
+    rif_state = NULL;
+    rif_order = NULL;
+    rif_count = 0;
+}
+
+static void pkgi_rif_thread(void)
+{
+    uint32_t start = pkgi_time_msec();
+
+    char path[256];
+    pkgi_snprintf(path, sizeof(path), "%s/pkgi_rif.bin", pkgi_get_config_folder());
+    rif_load(path);
+
+    uint32_t helpers = 0;
+    for (uint32_t i = 1; i < PKGI_RIF_THREADS; i++)
+    {
+        rif_starting = i;
+        if (!pkgi_start_thread("rif_thread", &pkgi_rif_helper))
+        {
+            break;
+        }
+        pkgi_sema_wait(rif_started);
+        helpers++;
+    }
+
+    rif_process(0);
+
+    // items of helpers that failed to start are processed here
+    for (uint32_t i = helpers + 1; i < PKGI_RIF_THREADS; i++)
+    {
+        rif_process(i);
+    }
+    for (uint32_t i = 0; i < helpers; i++)
+    {
+        pkgi_sema_wait(rif_helper_done);
+    }
+
+    if (rif_abort)
+    {
+        pkgi_sema_signal(rif_done);
+        return;
+    }
+
+    RifStats total = { 0, 0, 0 };
+    for (uint32_t i = 0; i < PKGI_RIF_THREADS; i++)
+    {
+        total.cached += rif_stats[i].cached;
+        total.decoded += rif_stats[i].decoded;
+        total.broken += rif_stats[i].broken;
+    }
+
+    uint32_t items = rif_count;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < items; i++)
+    {
+        if (rif_state[i] == RIF_STATE_VALID)
+        {
+            rif_order[count++] = i;
+        }
+    }
+    rif_count = count;
+    rif_sort();
+
+    if (total.decoded != 0 || total.cached != rif_old_count)
+    {
+        rif_save(path);
+    }
+
+    rif_msec = pkgi_time_msec() - start;
+    LOG("zRIF pass: %u items, %u cached, %u decoded, %u broken in %u ms (%u ms per 1000 items)",
+        items, total.cached, total.decoded, total.broken, rif_msec, items ? rif_msec * 1000 / items : 0);
+
+    // UI reads zrif_broken only under lock, so it never sees items while helpers write them
+    pkgi_sema_wait(rif_lock);
+    for (uint32_t i = 0; i < items; i++)
+    {
+        if (rif_state[i] == RIF_STATE_BROKEN)
+        {
+            pkgi_db_get_unfiltered(i)->zrif_broken = 1;
+        }
+    }
+    rif_finished = 1;
+    pkgi_sema_signal(rif_lock);
+
+    pkgi_sema_signal(rif_done);
+}
+
+void pkgi_rif_init(void)
+{
+    rif_lock = pkgi_sema_create("rif_lock", 1, 1);
+    pkgi_zrif_init();
+}
+
+void pkgi_rif_start(void)
+{
+    rif_abort = 0;
+    for (uint32_t i = 0; i < PKGI_RIF_THREADS; i++)
+    {
+        rif_stats[i].cached = 0;
+        rif_stats[i].decoded = 0;
+        rif_stats[i].broken = 0;
+    }
+
+    rif_count = pkgi_db_total();
+    if (rif_count == 0)
+    {
+        return;
+    }
+
+    rif_records = pkgi_malloc(rif_count * sizeof(RifRecord));
+    rif_state = pkgi_malloc(rif_count);
+    rif_order = pkgi_malloc(rif_count * sizeof(uint32_t));
+    rif_started = pkgi_sema_create("rif_started", 0, 1);
+    rif_helper_done = pkgi_sema_create("rif_helper_done", 0, PKGI_RIF_THREADS);
+    rif_done = pkgi_sema_create("rif_done", 0, 1);
+    if (!rif_lock || !rif_records || !rif_state || !rif_order || !rif_started || !rif_helper_done || !rif_done)
+    {
+        LOG("cannot start zRIF pass");
+        rif_destroy();
+        return;
+    }
+
+    for (uint32_t i = 0; i < rif_count; i++)
+    {
+        rif_state[i] = RIF_STATE_NONE;
+    }
+
+    // set before thread starts, so pkgi_rif_stop called meanwhile waits for pass to finish
+    pkgi_sema_wait(rif_lock);
+    rif_running = 1;
+    pkgi_sema_signal(rif_lock);
+
+    if (!pkgi_start_thread("rif_thread", &pkgi_rif_thread))
+    {
+        pkgi_sema_wait(rif_lock);
+        int running = rif_running;
+        rif_running = 0;
+        pkgi_sema_signal(rif_lock);
+
+        if (running)
+        {
+            rif_destroy();
+        }
+        else
+        {
+            // pkgi_rif_stop already took over, it waits for pass and destroys it
+            pkgi_sema_signal(rif_done);
+        }
+    }
+}
+
+void pkgi_rif_stop(void)
+{
+    if (!rif_lock)
+    {
+        return;
+    }
+
+    pkgi_sema_wait(rif_lock);
+    int running = rif_running;
+    rif_running = 0;
+    pkgi_sema_signal(rif_lock);
+
+    if (!running)
+    {
+        return;
+    }
+
+    rif_abort = 1;
+    pkgi_sema_wait(rif_done);
+
+    // pkgi_rif_get is not using records after this, so they can be freed
+    pkgi_sema_wait(rif_lock);
+    rif_finished = 0;
+    pkgi_sema_signal(rif_lock);
+
+    rif_destroy();
+}
+
+int pkgi_rif_get(const DbItem* item, uint8_t* rif, char* error, uint32_t error_size)
+{
+    char key[PKGI_RIF_CONTENT_SIZE];
+    rif_key(key, item->content);
+
+    // records do not change after pass is finished, pkgi_rif_stop frees them only under lock
+    int found = 0;
+    if (rif_lock)
+    {
+        pkgi_sema_wait(rif_lock);
+        if (rif_finished)
+        {
+            const RifRecord* record = rif_find(rif_records, rif_order, rif_count, key);
+            if (record && record->zrif_hash == rif_hash(item->zrif))
+            {
+                pkgi_memcpy(rif, record->rif, PKGI_RIF_SIZE);
+                found = 1;
+            }
+        }
+        pkgi_sema_signal(rif_lock);
+    }
+
+    return found || pkgi_zrif_decode(item->zrif, rif, error, error_size);
+}
+
+int pkgi_rif_broken(const DbItem* item)
+{
+    int broken = 0;
+    if (rif_lock)
+    {
+        pkgi_sema_wait(rif_lock);
+        broken = item->zrif_broken;
+        pkgi_sema_signal(rif_lock);
+    }
+    return broken;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "pkgi_db.h"
+
+#include <stdint.h>
+
+// must be called once at startup, before any thread uses zRIF decoding
+void pkgi_rif_init(void);
+
+// background pass that decodes zRIF of every item after list is loaded, it marks items with
+// broken zRIF and keeps decoded RIFs in cache file, so next pass only decodes changed items
+void pkgi_rif_start(void);
+// aborts pass if it is still running, must be called before list is loaded again
+void pkgi_rif_stop(void);
+
+// gets RIF from cache when pass is finished, otherwise decodes zRIF of item
+int pkgi_rif_get(const DbItem* item, uint8_t* rif, char* error, uint32_t error_size);
+// if pass found that zRIF of item cannot be decoded, safe to call while pass is running
+int pkgi_rif_broken(const DbItem* item);
@@ -0,0 +1,80 @@
+#include "pkgi_ring.h"
+#include "pkgi.h"
+
+#include <stddef.h>
+
+static uint32_t ring_wait(void* sema, uint32_t* stalls)
+{
+    if (pkgi_sema_poll(sema))
+    {
+        return 0;
+    }
+
+    uint32_t start = pkgi_time_msec();
+    pkgi_sema_wait(sema);
+    (*stalls)++;
+    return pkgi_time_msec() - start;
+}
+
+int pkgi_ring_init(pkgi_ring* ring, const char* name, uint32_t capacity)
+{
+    ring->capacity = capacity;
+    ring->read = 0;
+    ring->write = 0;
+    ring->push_stalls = 0;
+    ring->push_stall_msec = 0;
+    ring->pop_stalls = 0;
+    ring->pop_stall_msec = 0;
+
+    ring->used = pkgi_sema_create(name, 0, capacity);
+    ring->free = pkgi_sema_create(name, capacity, capacity);
+    if (!ring->used || !ring->free)
+    {
+        pkgi_ring_destroy(ring);
+        return 0;
+    }
+    return 1;
+}
+
+void pkgi_ring_destroy(pkgi_ring* ring)
+{
+    if (ring->used)
+    {
+        pkgi_sema_destroy(ring->used);
+        ring->used = NULL;
+    }
+    if (ring->free)
+    {
+        pkgi_sema_destroy(ring->free);
+        ring->free = NULL;
+    }
+}
+
+void pkgi_ring_push(pkgi_ring* ring, void* item)
+{
+    ring->push_stall_msec += ring_wait(ring->free, &ring->push_stalls);
+    ring->items[ring->write] = item;
+    ring->write = (ring->write + 1) % ring->capacity;
+    pkgi_sema_signal(ring->used);
+}
+
+void* pkgi_ring_pop(pkgi_ring* ring)
+{
+    ring->pop_stall_msec += ring_wait(ring->used, &ring->pop_stalls);
+    void* item = ring->items[ring->read];
+    ring->read = (ring->read + 1) % ring->capacity;
+    pkgi_sema_signal(ring->free);
+    return item;
+}
+
+void* pkgi_ring_try_pop(pkgi_ring* ring)
+{
+    if (!pkgi_sema_poll(ring->used))
+    {
+        return NULL;
+    }
+    void* item = ring->items[ring->read];
+    ring->read = (ring->read + 1) % ring->capacity;
+    pkgi_sema_signal(ring->free);
+    return item;
+}
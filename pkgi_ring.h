@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PKGI_RING_MAX 16
+
+// bounded single producer / single consumer queue of pointers
+typedef struct {
+    void* items[PKGI_RING_MAX];
+    uint32_t capacity;
+    uint32_t read;  // only used by consumer
+    uint32_t write; // only used by producer
+    void* used;     // counts items in ring
+    void* free;     // counts free space in ring
+
+    // how many times and how long producer / consumer had to wait
+    uint32_t push_stalls;
+    uint32_t push_stall_msec;
+    uint32_t pop_stalls;
+    uint32_t pop_stall_msec;
+} pkgi_ring;
+
+int pkgi_ring_init(pkgi_ring* ring, const char* name, uint32_t capacity);
+void pkgi_ring_destroy(pkgi_ring* ring);
+
+void pkgi_ring_push(pkgi_ring* ring, void* item);
+void* pkgi_ring_pop(pkgi_ring* ring);
+// returns NULL if ring is empty
+void* pkgi_ring_try_pop(pkgi_ring* ring);
@@ -13,6 +13,37 @@
 
 #endif
 
+#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+
+// ARMv8 cpus with crypto extension have instructions for 4 rounds and message schedule,
+// Vita (Cortex-A9) does not have them, so this is selected only at compile time
+#define SHA256_ARMV8 1
+
+#include <arm_neon.h>
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+// SHA-NI is available on most x86 cpus since 2017, it is detected at runtime with cpuid
+// pkgi_bench on Xeon measures ~1.5 cycles/byte with SHA-NI and ~8.7 cycles/byte with C
+#define SHA256_X86 1
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA256_TARGET_SHANI
+#else
+#include <cpuid.h>
+#define SHA256_TARGET_SHANI __attribute__((target("sha,sse4.1")))
+#endif
+
+#endif
+
+// selected in sha256_setup, before that only C implementation is used
+static int sha256_backend = SHA256_BACKEND_C;
+
 static const uint32_t sha256_K[64] GCC_ALIGN(16) =
 {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
@@ -78,6 +109,69 @@ static inline uint32_t Gamma1(uint32_t x)
     a = t;                            \
 } while (0)
 
+#if SHA256_ARMV8
+
+// 4 rounds, state is kept as ABCD and EFGH
+#define ROUNDx4_ARMV8(m, n) do { \
+    uint32x4_t tmp = vaddq_u32(m, vld1q_u32(sha256_K + n)); \
+    uint32x4_t prev = state0; \
+    state0 = vsha256hq_u32(state0, state1, tmp); \
+    state1 = vsha256h2q_u32(state1, prev, tmp); \
+} while (0)
+
+static void sha256_process_armv8(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(state + 0);
+    uint32x4_t state1 = vld1q_u32(state + 4);
+
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        uint32x4_t abcd = state0;
+        uint32x4_t efgh = state1;
+
+        uint32x4_t m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buffer + 0*16)));
+        uint32x4_t m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buffer + 1*16)));
+        uint32x4_t m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buffer + 2*16)));
+        uint32x4_t m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buffer + 3*16)));
+        buffer += SHA256_BLOCK_SIZE;
+
+        for (uint32_t r = 0; r < 64; r += 16)
+        {
+            if (r != 0)
+            {
+                m0 = vsha256su1q_u32(vsha256su0q_u32(m0, m1), m2, m3);
+            }
+            ROUNDx4_ARMV8(m0, r + 0);
+
+            if (r != 0)
+            {
+                m1 = vsha256su1q_u32(vsha256su0q_u32(m1, m2), m3, m0);
+            }
+            ROUNDx4_ARMV8(m1, r + 4);
+
+            if (r != 0)
+            {
+                m2 = vsha256su1q_u32(vsha256su0q_u32(m2, m3), m0, m1);
+            }
+            ROUNDx4_ARMV8(m2, r + 8);
+
+            if (r != 0)
+            {
+                m3 = vsha256su1q_u32(vsha256su0q_u32(m3, m0), m1, m2);
+            }
+            ROUNDx4_ARMV8(m3, r + 12);
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+    }
+
+    vst1q_u32(state + 0, state0);
+    vst1q_u32(state + 4, state1);
+}
+
+#endif
+
 #if __ARM_NEON__
 
 #define ROUNDx4(x, n, a, b, c, d, e, f, g, h) do { \
@@ -146,7 +240,8 @@ static inline uint32_t Gamma1(uint32_t x)
     x3 = q0; \
 } while (0)
 
-static void sha256_process(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
+// on Vita C implementation prepares message schedule with Neon
+static void sha256_process_c(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
 {
     for (uint32_t i = 0; i < blocks; i++)
     {
@@ -200,7 +295,7 @@ static void sha256_process(uint32_t* state, const uint8_t* buffer, uint32_t bloc
 
 #else
 
-static void sha256_process(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
+static void sha256_process_c(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
 {
     for (uint32_t i = 0; i < blocks; i++)
     {
@@ -242,6 +337,146 @@ static void sha256_process(uint32_t* state, const uint8_t* buffer, uint32_t bloc
 
 #endif
 
+#if SHA256_X86
+
+static void sha256_cpuid(uint32_t leaf, uint32_t* regs)
+{
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, leaf, 0);
+#else
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    __get_cpuid_count(leaf, 0, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+}
+
+static int sha256_x86_backend(void)
+{
+    uint32_t regs[4];
+    sha256_cpuid(0, regs);
+    if (regs[0] < 7)
+    {
+        return SHA256_BACKEND_C;
+    }
+
+    sha256_cpuid(1, regs);
+    int sse41 = (regs[2] & (1 << 19)) && (regs[2] & (1 << 9)); // SSE4.1 & SSSE3
+
+    sha256_cpuid(7, regs);
+    int sha = (regs[1] & (1 << 29)) != 0;
+
+    return sse41 && sha ? SHA256_BACKEND_SHANI : SHA256_BACKEND_C;
+}
+
+// state is kept as ABEF and CDGH pairs, sha256rnds2 does 2 rounds with message in low half
+#define ROUNDx4_SHANI(m, n) do { \
+    __m128i msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)(sha256_K + n))); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    msg = _mm_shuffle_epi32(msg, 0x0e); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+} while (0)
+
+// w[i..i+3] from w[i-16..i-13], w[i-12..i-9], w[i-8..i-5] and w[i-4..i-1]
+#define SCHEDULE_SHANI(m0, m1, m2, m3) \
+    _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3)
+
+SHA256_TARGET_SHANI
+static void sha256_process_shani(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
+{
+    const __m128i shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 0)), 0xb1);    // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1b); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                    // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);                                         // CDGH
+
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(buffer + 0*16)), shuffle);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(buffer + 1*16)), shuffle);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(buffer + 2*16)), shuffle);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(buffer + 3*16)), shuffle);
+        buffer += SHA256_BLOCK_SIZE;
+
+        ROUNDx4_SHANI(m0, 0);
+        ROUNDx4_SHANI(m1, 4);
+        ROUNDx4_SHANI(m2, 8);
+        ROUNDx4_SHANI(m3, 12);
+
+        for (uint32_t r = 16; r < 64; r += 16)
+        {
+            m0 = SCHEDULE_SHANI(m0, m1, m2, m3);
+            ROUNDx4_SHANI(m0, r + 0);
+            m1 = SCHEDULE_SHANI(m1, m2, m3, m0);
+            ROUNDx4_SHANI(m1, r + 4);
+            m2 = SCHEDULE_SHANI(m2, m3, m0, m1);
+            ROUNDx4_SHANI(m2, r + 8);
+            m3 = SCHEDULE_SHANI(m3, m0, m1, m2);
+            ROUNDx4_SHANI(m3, r + 12);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);           // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);        // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);     // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);        // HGFE
+    _mm_storeu_si128((__m128i*)(state + 0), state0);
+    _mm_storeu_si128((__m128i*)(state + 4), state1);
+}
+
+#endif
+
+static void sha256_process(uint32_t* state, const uint8_t* buffer, uint32_t blocks)
+{
+#if SHA256_X86
+    if (sha256_backend == SHA256_BACKEND_SHANI)
+    {
+        sha256_process_shani(state, buffer, blocks);
+        return;
+    }
+#endif
+#if SHA256_ARMV8
+    if (sha256_backend == SHA256_BACKEND_ARMV8)
+    {
+        sha256_process_armv8(state, buffer, blocks);
+        return;
+    }
+#endif
+    sha256_process_c(state, buffer, blocks);
+}
+
+static int sha256_best_backend(void)
+{
+#if SHA256_X86
+    return sha256_x86_backend();
+#elif SHA256_ARMV8
+    return SHA256_BACKEND_ARMV8;
+#else
+    return SHA256_BACKEND_C;
+#endif
+}
+
+int sha256_setup(void)
+{
+    sha256_backend = sha256_best_backend();
+    return sha256_backend;
+}
+
+int sha256_set_backend(int backend)
+{
+    if (backend != SHA256_BACKEND_C && backend != sha256_best_backend())
+    {
+        return 0;
+    }
+    sha256_backend = backend;
+    return 1;
+}
+
 void sha256_init(sha256_ctx* ctx)
 {
     ctx->count = 0;
@@ -287,6 +522,21 @@ void sha256_update(sha256_ctx* ctx, const uint8_t* buffer, uint32_t size)
     pkgi_memcpy(ctx->buffer + left, buffer, size);
 }
 
+// fits in 32KB L1 data cache of Vita cpu together with both contexts
+#define SHA256_UPDATE2_STEP (16 * 1024)
+
+void sha256_update2(sha256_ctx* first, sha256_ctx* second, const uint8_t* buffer, uint32_t size)
+{
+    while (size != 0)
+    {
+        uint32_t step = min32(size, SHA256_UPDATE2_STEP);
+        sha256_update(first, buffer, step);
+        sha256_update(second, buffer, step);
+        buffer += step;
+        size -= step;
+    }
+}
+
 void sha256_finish(sha256_ctx* ctx, uint8_t* digest)
 {
     static const uint8_t padding[SHA256_BLOCK_SIZE] = { 0x80 };
@@ -11,6 +11,19 @@ typedef struct {
     uint64_t count;
 } sha256_ctx;
 
+// block function implementations, every build has C and at most one accelerated backend
+#define SHA256_BACKEND_C 0
+#define SHA256_BACKEND_SHANI 1 // x86 SHA extensions, detected at runtime
+#define SHA256_BACKEND_ARMV8 2 // ARMv8 crypto extensions, selected at compile time
+
+// selects fastest backend that cpu supports and returns it, must be called once at startup
+// before any thread uses sha256 - until then C backend is used
+int sha256_setup(void);
+// forces backend, returns 0 if build or cpu does not support it
+int sha256_set_backend(int backend);
+
 void sha256_init(sha256_ctx* ctx);
 void sha256_update(sha256_ctx* ctx, const uint8_t* buffer, uint32_t size);
+// same as sha256_update on both contexts, but buffer is read by second hash while it is still in L1 cache
+void sha256_update2(sha256_ctx* first, sha256_ctx* second, const uint8_t* buffer, uint32_t size);
 void sha256_finish(sha256_ctx* ctx, uint8_t* digest);
@@ -42,6 +42,8 @@ static uint32_t g_button_frame_count;
 
 struct pkgi_http
 {
+    LONG used;
+
     HANDLE handle;
     uint64_t size;
     uint64_t offset;
@@ -49,7 +51,7 @@ struct pkgi_http
     HINTERNET conn;
 };
 
-static pkgi_http g_http[4];
+static pkgi_http g_http[8];
 
 #define PKGI_FOLDER "pkgi"
 #define PKGI_APP_FOLDER "app"
@@ -144,6 +146,16 @@ int pkgi_memequ(const void* a, const void* b, uint32_t size)
     return memcmp(a, b, size) == 0;
 }
 
+void* pkgi_malloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+void pkgi_free(void* ptr)
+{
+    free(ptr);
+}
+
 int pkgi_is_unsafe_mode(void)
 {
     return 1;
@@ -461,11 +473,13 @@ static DWORD WINAPI pkgi_win32_thread(void* arg)
     return 0;
 }
 
-void pkgi_start_thread(const char* name, pkgi_thread_entry* start)
+int pkgi_start_thread(const char* name, pkgi_thread_entry* start)
 {
     PKGI_UNUSED(name);
     HANDLE h = CreateThread(NULL, 0, &pkgi_win32_thread, start, 0, NULL);
     Assert(h);
+    CloseHandle(h);
+    return 1;
 }
 
 void pkgi_sleep(uint32_t msec)
@@ -473,6 +487,36 @@ void pkgi_sleep(uint32_t msec)
     Sleep(msec);
 }
 
+void* pkgi_sema_create(const char* name, uint32_t count, uint32_t max)
+{
+    PKGI_UNUSED(name);
+    HANDLE h = CreateSemaphoreW(NULL, count, max, NULL);
+    Assert(h);
+    return h;
+}
+
+void pkgi_sema_wait(void* sema)
+{
+    DWORD res = WaitForSingleObject(sema, INFINITE);
+    Assert(res == WAIT_OBJECT_0);
+}
+
+int pkgi_sema_poll(void* sema)
+{
+    return WaitForSingleObject(sema, 0) == WAIT_OBJECT_0;
+}
+
+void pkgi_sema_signal(void* sema)
+{
+    BOOL ok = ReleaseSemaphore(sema, 1, NULL);
+    Assert(ok);
+}
+
+void pkgi_sema_destroy(void* sema)
+{
+    CloseHandle(sema);
+}
+
 int pkgi_load(const char* name, void* data, uint32_t max)
 {
     WCHAR wname[MAX_PATH];
@@ -663,21 +707,44 @@ int pkgi_text_height(const char* text)
     return r.bottom - r.top;
 }
 
-pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
+static pkgi_http* pkgi_http_alloc(void)
 {
-    pkgi_http* http = NULL;
-    for (size_t i = 0; i < 4; i++)
+    for (size_t i = 0; i < PKGI_COUNTOF(g_http); i++)
     {
-        if (g_http[i].handle == NULL && g_http[i].conn == NULL)
+        if (InterlockedExchange(&g_http[i].used, 1) == 0)
         {
-            http = g_http + i;
-            break;
+            return g_http + i;
         }
     }
 
+    LOG("too many simultaneous http requests");
+    return NULL;
+}
+
+static HINTERNET pkgi_http_open_url(const char* url, uint64_t offset, uint64_t end)
+{
+    WCHAR headers[256];
+    if (end != 0)
+    {
+        wsprintfW(headers, L"Range: bytes=%I64u-%I64u", offset, end - 1);
+    }
+    else if (offset != 0)
+    {
+        wsprintfW(headers, L"Range: bytes=%I64u-", offset);
+    }
+
+    WCHAR wurl[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, url, -1, wurl, MAX_PATH);
+
+    DWORD flags = INTERNET_FLAG_IGNORE_CERT_CN_INVALID | INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_SECURE;
+    return InternetOpenUrlW(g_inet, wurl, offset || end ? headers : NULL, (DWORD)-1, flags, 0);
+}
+
+pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
+{
+    pkgi_http* http = pkgi_http_alloc();
     if (http == NULL)
     {
-        LOG("too many simultaneous http requests");
         return NULL;
     }
 
@@ -704,23 +771,14 @@ pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
 
     if (handle == INVALID_HANDLE_VALUE)
     {
-        WCHAR headers[256];
-        if (offset != 0)
-        {
-            wsprintfW(headers, L"Range: bytes=%I64u-", offset);
-        }
-
-        WCHAR wurl[MAX_PATH];
-        MultiByteToWideChar(CP_UTF8, 0, url, -1, wurl, MAX_PATH);
-
-        DWORD flags = INTERNET_FLAG_IGNORE_CERT_CN_INVALID | INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_SECURE;
-        HINTERNET conn = InternetOpenUrlW(g_inet, wurl, offset ? headers : NULL, (DWORD)-1, flags, 0);
+        HINTERNET conn = pkgi_http_open_url(url, offset, 0);
         if (conn)
         {
             http->conn = conn;
         }
         else
         {
+            http->used = 0;
             http = NULL;
         }
     }
@@ -747,6 +805,29 @@ pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
     return http;
 }
 
+pkgi_http* pkgi_http_get_range(const char* url, uint64_t offset, uint64_t end)
+{
+    pkgi_http* http = pkgi_http_alloc();
+    if (http == NULL)
+    {
+        return NULL;
+    }
+
+    http->conn = pkgi_http_open_url(url, offset, end);
+    if (http->conn == NULL)
+    {
+        http->used = 0;
+        return NULL;
+    }
+
+    return http;
+}
+
+int pkgi_http_is_local(pkgi_http* http)
+{
+    return http->conn == NULL;
+}
+
 int pkgi_http_response_length(pkgi_http* http, int64_t* length)
 {
     if (http->conn)
@@ -849,6 +930,16 @@ void pkgi_http_close(pkgi_http* http)
         CloseHandle(http->handle);
         http->handle = NULL;
     }
+    http->used = 0;
+}
+
+int pkgi_mkdir(const char* path)
+{
+    WCHAR wpath[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH);
+
+    BOOL ok = CreateDirectoryW(wpath, NULL);
+    return ok || GetLastError() == ERROR_ALREADY_EXISTS;
 }
 
 int pkgi_mkdirs(char* path)
@@ -892,6 +983,21 @@ void pkgi_rm(const char* file)
     }
 }
 
+int pkgi_rename(const char* from, const char* to)
+{
+    WCHAR wfrom[MAX_PATH];
+    WCHAR wto[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, from, -1, wfrom, MAX_PATH);
+    MultiByteToWideChar(CP_UTF8, 0, to, -1, wto, MAX_PATH);
+
+    if (!MoveFileW(wfrom, wto))
+    {
+        LOG("cannot rename %s to %s", from, to);
+        return 0;
+    }
+    return 1;
+}
+
 int64_t pkgi_get_size(const char* path)
 {
     WCHAR wpath[MAX_PATH];
@@ -942,7 +1048,34 @@ void*pkgi_openrw(const char* path)
     WCHAR wpath[MAX_PATH];
     MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH);
 
-    HANDLE f = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    // allows different parts of same file to be written by multiple threads
+    HANDLE f = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    return f;
+}
+
+int pkgi_preallocate(void* f, uint64_t size)
+{
+    // reserves clusters without changing end of file
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    if (!SetFileInformationByHandle(f, FileAllocationInfo, &info, sizeof(info)))
+    {
+        return GetLastError() != ERROR_DISK_FULL;
+    }
+    return 1;
+}
+
+void* pkgi_open(const char* path)
+{
+    WCHAR wpath[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH);
+
+    HANDLE f = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
     if (f == INVALID_HANDLE_VALUE)
     {
         return NULL;
@@ -951,6 +1084,48 @@ void*pkgi_openrw(const char* path)
     return f;
 }
 
+const void* pkgi_map(const char* path, uint64_t* size)
+{
+    WCHAR wpath[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH);
+
+    HANDLE f = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    // empty file cannot be mapped
+    LARGE_INTEGER length;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(f, &length) && length.QuadPart != 0)
+    {
+        mapping = CreateFileMappingW(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(f);
+
+    if (!mapping)
+    {
+        return NULL;
+    }
+
+    // view keeps mapping alive after its handle is closed
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (data)
+    {
+        *size = length.QuadPart;
+    }
+    return data;
+}
+
+void pkgi_unmap(const void* data, uint64_t size)
+{
+    PKGI_UNUSED(size);
+    UnmapViewOfFile(data);
+}
+
 int pkgi_read(void* f, void* buffer, uint32_t size)
 {
     DWORD read;
@@ -965,6 +1140,18 @@ int pkgi_write(void* f, const void* buffer, uint32_t size)
     return ok && written == size;
 }
 
+int pkgi_sync(void* f)
+{
+    return FlushFileBuffers(f);
+}
+
+int pkgi_seek(void* f, uint64_t offset)
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = offset;
+    return SetFilePointerEx(f, pos, NULL, FILE_BEGIN);
+}
+
 void pkgi_close(void* f)
 {
     CloseHandle(f);
@@ -23,6 +23,7 @@
 #include <psp2/promoterutil.h>
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -50,6 +51,7 @@ static int g_log_socket;
 #define VITA_COLOR(c) RGBA8((c)&0xff, (c>>8)&0xff, (c>>16)&0xff, 255)
 
 #define PKGI_ERRNO_EEXIST (int)(0x80010000 + SCE_NET_EEXIST)
+#define PKGI_ERRNO_ENOSPC (int)(0x80010000 + SCE_NET_ENOSPC)
 
 #define PKGI_USER_AGENT "libhttp/3.65 (PS Vita)"
 
@@ -128,6 +130,16 @@ int pkgi_memequ(const void* a, const void* b, uint32_t size)
     return memcmp(a, b, size) == 0;
 }
 
+void* pkgi_malloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+void pkgi_free(void* ptr)
+{
+    free(ptr);
+}
+
 static void pkgi_start_debug_log(void)
 {
 #ifdef PKGI_ENABLE_LOGGING
@@ -666,17 +678,23 @@ static int pkgi_vita_thread(SceSize args, void* argp)
     return sceKernelExitDeleteThread(0);
 }
 
-void pkgi_start_thread(const char* name, pkgi_thread_entry* start)
+int pkgi_start_thread(const char* name, pkgi_thread_entry* start)
 {
     SceUID id = sceKernelCreateThread(name, &pkgi_vita_thread, 0x40, 1024*1024, 0, 0, NULL);
     if (id < 0)
     {
         LOG("failed to start %s thread", name);
+        return 0;
     }
-    else
+
+    int err = sceKernelStartThread(id, sizeof(start), &start);
+    if (err < 0)
     {
-        sceKernelStartThread(id, sizeof(start), &start);
+        LOG("failed to start %s thread, err=0x%08x", name, err);
+        sceKernelDeleteThread(id);
+        return 0;
     }
+    return 1;
 }
 
 void pkgi_sleep(uint32_t msec)
@@ -684,6 +702,45 @@ void pkgi_sleep(uint32_t msec)
     sceKernelDelayThread(msec * 1000);
 }
 
+void* pkgi_sema_create(const char* name, uint32_t count, uint32_t max)
+{
+    SceUID sema = sceKernelCreateSema(name, 0, count, max, NULL);
+    if (sema < 0)
+    {
+        LOG("failed to create %s semaphore, err=0x%08x", name, sema);
+        return NULL;
+    }
+    return (void*)(intptr_t)sema;
+}
+
+void pkgi_sema_wait(void* sema)
+{
+    int err = sceKernelWaitSema((SceUID)(intptr_t)sema, 1, NULL);
+    if (err < 0)
+    {
+        LOG("sceKernelWaitSema failed, err=0x%08x", err);
+    }
+}
+
+int pkgi_sema_poll(void* sema)
+{
+    return sceKernelPollSema((SceUID)(intptr_t)sema, 1) == 0;
+}
+
+void pkgi_sema_signal(void* sema)
+{
+    int err = sceKernelSignalSema((SceUID)(intptr_t)sema, 1);
+    if (err < 0)
+    {
+        LOG("sceKernelSignalSema failed, err=0x%08x", err);
+    }
+}
+
+void pkgi_sema_destroy(void* sema)
+{
+    sceKernelDeleteSema((SceUID)(intptr_t)sema);
+}
+
 int pkgi_load(const char* name, void* data, uint32_t max)
 {
     SceUID fd = sceIoOpen(name, SCE_O_RDONLY, 0777);
@@ -831,30 +888,103 @@ struct pkgi_http
     int req;
 };
 
-static pkgi_http g_http[4];
+static pkgi_http g_http[8];
 
-pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
+static pkgi_http* pkgi_http_alloc(void)
 {
-    LOG("http get");
+    // http requests are started from multiple download threads
+    for (size_t i = 0; i < PKGI_COUNTOF(g_http); i++)
+    {
+        if (__atomic_exchange_n(&g_http[i].used, 1, __ATOMIC_SEQ_CST) == 0)
+        {
+            return g_http + i;
+        }
+    }
 
-    pkgi_http* http = NULL;
-    for (size_t i = 0; i < 4; i++)
+    LOG("too many simultaneous http requests");
+    return NULL;
+}
+
+static int pkgi_http_send(pkgi_http* http, const char* url, uint64_t offset, uint64_t end)
+{
+    int tmpl = -1;
+    int conn = -1;
+    int req = -1;
+    int result = 0;
+
+    LOG("starting http GET request for %s", url);
+
+    if ((tmpl = sceHttpCreateTemplate(PKGI_USER_AGENT, SCE_HTTP_VERSION_1_1, SCE_TRUE)) < 0)
+    {
+        LOG("sceHttpCreateTemplate failed: 0x%08x", tmpl);
+        goto bail;
+    }
+    // sceHttpSetRecvTimeOut(tmpl, 10 * 1000 * 1000);
+
+    if ((conn = sceHttpCreateConnectionWithURL(tmpl, url, SCE_FALSE)) < 0)
+    {
+        LOG("sceHttpCreateConnectionWithURL failed: 0x%08x", conn);
+        goto bail;
+    }
+
+    if ((req = sceHttpCreateRequestWithURL(conn, SCE_HTTP_METHOD_GET, url, 0)) < 0)
+    {
+        LOG("sceHttpCreateRequestWithURL failed: 0x%08x", req);
+        goto bail;
+    }
+
+    int err;
+
+    if (offset != 0 || end != 0)
     {
-        if (g_http[i].used == 0)
+        char range[64];
+        if (end != 0)
         {
-            http = g_http + i;
-            break;
+            pkgi_snprintf(range, sizeof(range), "bytes=%llu-%llu", offset, end - 1);
+        }
+        else
+        {
+            pkgi_snprintf(range, sizeof(range), "bytes=%llu-", offset);
         }
+        if ((err = sceHttpAddRequestHeader(req, "Range", range, SCE_HTTP_HEADER_ADD)) < 0)
+        {
+            LOG("sceHttpAddRequestHeader failed: 0x%08x", err);
+            goto bail;
+        }
+    }
+
+    if ((err = sceHttpSendRequest(req, NULL, 0)) < 0)
+    {
+        LOG("sceHttpSendRequest failed: 0x%08x", err);
+        goto bail;
     }
 
+    http->local = 0;
+    http->tmpl = tmpl;
+    http->conn = conn;
+    http->req = req;
+    tmpl = conn = req = -1;
+
+    result = 1;
+
+bail:
+    if (req >= 0) sceHttpDeleteRequest(req);
+    if (conn >= 0) sceHttpDeleteConnection(conn);
+    if (tmpl >= 0) sceHttpDeleteTemplate(tmpl);
+
+    return result;
+}
+
+pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
+{
+    LOG("http get");
+
+    pkgi_http* http = pkgi_http_alloc();
     if (!http)
     {
-        LOG("too many simultaneous http requests");
         return NULL;
     }
 
-    pkgi_http* result = NULL;
-
     char path[256];
 
     if (content)
@@ -885,83 +1015,54 @@ pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
         {
             LOG("cannot get size of file %s", path);
             sceIoClose(http->fd);
+            http->used = 0;
             return NULL;
         }
 
-        http->used = 1;
+        // same as http response, local file is read from requested offset
         http->local = 1;
-        http->offset = 0;
-        http->size = stat.st_size;
+        http->offset = offset;
+        http->size = stat.st_size - offset;
 
-        result = http;
+        return http;
     }
-    else
-    {
-        if (content)
-        {
-            LOG("%s not found, downloading url", path);
-        }
-
-        int tmpl = -1;
-        int conn = -1;
-        int req = -1;
-
-        LOG("starting http GET request for %s", url);
-
-        if ((tmpl = sceHttpCreateTemplate(PKGI_USER_AGENT, SCE_HTTP_VERSION_1_1, SCE_TRUE)) < 0)
-        {
-            LOG("sceHttpCreateTemplate failed: 0x%08x", tmpl);
-            goto bail;
-        }
-        // sceHttpSetRecvTimeOut(tmpl, 10 * 1000 * 1000);
 
-        if ((conn = sceHttpCreateConnectionWithURL(tmpl, url, SCE_FALSE)) < 0)
-        {
-            LOG("sceHttpCreateConnectionWithURL failed: 0x%08x", conn);
-            goto bail;
-        }
-
-        if ((req = sceHttpCreateRequestWithURL(conn, SCE_HTTP_METHOD_GET, url, 0)) < 0)
-        {
-            LOG("sceHttpCreateRequestWithURL failed: 0x%08x", req);
-            goto bail;
-        }
-
-        int err;
+    if (content)
+    {
+        LOG("%s not found, downloading url", path);
+    }
 
-        if (offset != 0)
-        {
-            char range[64];
-            pkgi_snprintf(range, sizeof(range), "bytes=%llu-", offset);
-            if ((err = sceHttpAddRequestHeader(req, "Range", range, SCE_HTTP_HEADER_ADD)) < 0)
-            {
-                LOG("sceHttpAddRequestHeader failed: 0x%08x", err);
-                goto bail;
-            }
-        }
+    if (!pkgi_http_send(http, url, offset, 0))
+    {
+        http->used = 0;
+        return NULL;
+    }
 
-        if ((err = sceHttpSendRequest(req, NULL, 0)) < 0)
-        {
-            LOG("sceHttpSendRequest failed: 0x%08x", err);
-            goto bail;
-        }
+    return http;
+}
 
-        http->used = 1;
-        http->local = 0;
-        http->tmpl = tmpl;
-        http->conn = conn;
-        http->req = req;
-        tmpl = conn = req = -1;
+pkgi_http* pkgi_http_get_range(const char* url, uint64_t offset, uint64_t end)
+{
+    LOG("http get range %llu-%llu", offset, end);
 
-        result = http;
+    pkgi_http* http = pkgi_http_alloc();
+    if (!http)
+    {
+        return NULL;
+    }
 
-    bail:
-        if (req < 0) sceHttpDeleteRequest(req);
-        if (conn < 0) sceHttpDeleteConnection(conn);
-        if (tmpl < 0) sceHttpDeleteTemplate(tmpl);
+    if (!pkgi_http_send(http, url, offset, end))
+    {
+        http->used = 0;
+        return NULL;
     }
 
-    return result;
+    return http;
+}
+
+int pkgi_http_is_local(pkgi_http* http)
+{
+    return http->local;
 }
 
 int pkgi_http_response_length(pkgi_http* http, int64_t* length)
@@ -1053,6 +1154,18 @@ void pkgi_http_close(pkgi_http* http)
     http->used = 0;
 }
 
+int pkgi_mkdir(const char* path)
+{
+    LOG("mkdir %s", path);
+    int err = sceIoMkdir(path, 0777);
+    if (err < 0 && err != PKGI_ERRNO_EEXIST)
+    {
+        LOG("sceIoMkdir %s err=0x%08x", path, (uint32_t)err);
+        return 0;
+    }
+    return 1;
+}
+
 int pkgi_mkdirs(char* path)
 {
     // LOG("pkgi_mkdirs enter %llu", sceKernelGetProcessTimeWide() / 1000);
@@ -1095,6 +1208,17 @@ void pkgi_rm(const char* file)
     }
 }
 
+int pkgi_rename(const char* from, const char* to)
+{
+    int err = sceIoRename(from, to);
+    if (err < 0)
+    {
+        LOG("error renaming %s to %s, err=0x%08x", from, to, err);
+        return 0;
+    }
+    return 1;
+}
+
 int64_t pkgi_get_size(const char* path)
 {
     SceIoStat stat;
@@ -1135,6 +1259,50 @@ void* pkgi_openrw(const char* path)
     return (void*)(intptr_t)fd;
 }
 
+int pkgi_preallocate(void* f, uint64_t size)
+{
+    // there is no call to only reserve space, so file is extended to full size and
+    // filesystem allocates all clusters for it before data is written
+    SceIoStat stat = { 0 };
+    stat.st_size = size;
+
+    int err = sceIoChstatByFd((SceUID)(intptr_t)f, &stat, SCE_CST_SIZE);
+    if (err < 0)
+    {
+        LOG("cannot preallocate %llu bytes, err=0x%08x", size, err);
+        return err != PKGI_ERRNO_ENOSPC;
+    }
+    return 1;
+}
+
+void* pkgi_open(const char* path)
+{
+    LOG("sceIoOpen open on %s", path);
+    SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0777);
+    if (fd < 0)
+    {
+        LOG("cannot open %s, err=0x%08x", path, fd);
+        return NULL;
+    }
+    LOG("sceIoOpen returned fd=%d", fd);
+
+    return (void*)(intptr_t)fd;
+}
+
+const void* pkgi_map(const char* path, uint64_t* size)
+{
+    // files cannot be mapped to memory, pkgi_reader reads them ahead in background thread
+    PKGI_UNUSED(path);
+    PKGI_UNUSED(size);
+    return NULL;
+}
+
+void pkgi_unmap(const void* data, uint64_t size)
+{
+    PKGI_UNUSED(data);
+    PKGI_UNUSED(size);
+}
+
 void* pkgi_append(const char* path)
 {
     LOG("sceIoOpen append on %s", path);
@@ -1178,6 +1346,28 @@ int pkgi_write(void* f, const void* buffer, uint32_t size)
     return (uint32_t)write == size;
 }
 
+int pkgi_sync(void* f)
+{
+    int err = sceIoSyncByFd((SceUID)(intptr_t)f, 0);
+    if (err < 0)
+    {
+        LOG("sceIoSyncByFd error 0x%08x", err);
+        return 0;
+    }
+    return 1;
+}
+
+int pkgi_seek(void* f, uint64_t offset)
+{
+    SceOff pos = sceIoLseek((SceUID)(intptr_t)f, offset, SCE_SEEK_SET);
+    if (pos < 0)
+    {
+        LOG("sceIoLseek error 0x%08x", (uint32_t)pos);
+        return 0;
+    }
+    return 1;
+}
+
 void pkgi_close(void* f)
 {
     SceUID fd = (SceUID)(intptr_t)f;
@@ -175,9 +175,29 @@ static uint32_t zlib_inflate(const uint8_t* in, uint32_t inlen, uint8_t* out, ui
     return dlen;
 }
 
+void pkgi_zrif_init(void)
+{
+    // empty block with fixed codes, puff builds their tables on first use without any locking
+    static const uint8_t empty[] = { 0x03, 0x00 };
+
+    uint8_t out[1];
+    unsigned long dlen = 0;
+    unsigned long slen = sizeof(empty);
+    puff(0, out, &dlen, empty, &slen);
+}
+
 int pkgi_zrif_decode(const char* str, uint8_t* rif, char* error, uint32_t error_size)
 {
     uint8_t raw[512];
+
+    // every item in list is decoded in background, so bad input must not overflow buffer
+    size_t size = strlen(str);
+    if (size == 0 || size / 4 * 3 + 3 > sizeof(raw))
+    {
+        pkgi_strncpy(error, error_size, "wrong size of zRIF, is it corrupted?");
+        return 0;
+    }
+
     uint32_t len = base64_decode(str, raw);
 
     uint8_t out[512 + sizeof(zrif_dict)];
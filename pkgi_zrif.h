@@ -2,4 +2,6 @@
 
 #include <stdint.h>
 
+// builds static inflate tables, must be called before pkgi_zrif_decode is used from multiple threads
+void pkgi_zrif_init(void);
 int pkgi_zrif_decode(const char* str, uint8_t* rif, char* error, uint32_t error_size);